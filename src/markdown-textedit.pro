@@ -5,7 +5,9 @@ SUBDIRS += \
     peg-markdown-highlight \
     pmh-adapter \
     markdown-textedit \
-    test-markdown-textedit
+    test-markdown-textedit \
+    test-highlighter
 
 markdown-textedit.depends = pmh-adapter peg-markdown-highlight
 test-markdown-textedit.depends = markdown-textedit
+test-highlighter.depends = peg-markdown-highlight
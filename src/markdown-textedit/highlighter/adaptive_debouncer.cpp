@@ -0,0 +1,81 @@
+﻿
+#include "adaptive_debouncer.h"
+
+// Weight of the newest sample in the moving averages
+#define SMOOTHING_FACTOR 0.3
+
+// Delay bounds, in milliseconds
+#define MIN_DELAY_MS 0
+#define MAX_DELAY_MS 1000
+
+// Intervals longer than this are a pause, not typing cadence
+#define TYPING_PAUSE_MS 1000
+
+namespace mdtextedit
+{
+
+static double smooth(double average, double sample, int count)
+{
+    if (count <= 1)
+        return sample;
+    return average + SMOOTHING_FACTOR * (sample - average);
+}
+
+void AdaptiveDebouncer::edit_arrived()
+{
+    QMutexLocker locker(&_mutex);
+
+    // the first edit only starts the clock; intervals come with the next ones
+    ++_stats.edit_count;
+    if (_since_last_edit.isValid())
+    {
+        const qint64 interval = qMin(_since_last_edit.restart(), (qint64) TYPING_PAUSE_MS);
+        _stats.edit_interval_ms = smooth(_stats.edit_interval_ms, interval,
+                                         _stats.edit_count - 1);
+    }
+    else
+    {
+        _since_last_edit.start();
+        _stats.edit_interval_ms = TYPING_PAUSE_MS;
+    }
+
+    update_delay();
+}
+
+void AdaptiveDebouncer::parse_finished(qint64 elapsed_ms, int document_length)
+{
+    QMutexLocker locker(&_mutex);
+
+    ++_stats.parse_count;
+    _stats.parse_ms = smooth(_stats.parse_ms, elapsed_ms, _stats.parse_count);
+    _stats.document_length = document_length;
+
+    update_delay();
+}
+
+int AdaptiveDebouncer::delay() const
+{
+    QMutexLocker locker(&_mutex);
+    return _stats.delay_ms;
+}
+
+DebounceStats AdaptiveDebouncer::stats() const
+{
+    QMutexLocker locker(&_mutex);
+    return _stats;
+}
+
+void AdaptiveDebouncer::update_delay()
+{
+    // Keep parsing below about a third of the time while typing
+    double delay = 2 * _stats.parse_ms;
+
+    // A parse that takes a noticeable part of the typing interval would run
+    // for nearly every keystroke; wait for a pause instead
+    if (_stats.edit_interval_ms < TYPING_PAUSE_MS && 4 * _stats.parse_ms >= _stats.edit_interval_ms)
+        delay = qMax(delay, 1.5 * _stats.edit_interval_ms);
+
+    _stats.delay_ms = qBound(MIN_DELAY_MS, (int) delay, MAX_DELAY_MS);
+}
+
+}
@@ -0,0 +1,51 @@
+﻿
+#ifndef ___HEADFILE_65D5FE03_94F8_4D21_8F57_3AC72E8908CA_
+#define ___HEADFILE_65D5FE03_94F8_4D21_8F57_3AC72E8908CA_
+
+#include <QElapsedTimer>
+#include <QMutex>
+
+namespace mdtextedit
+{
+
+/**
+ * Measurements the debounce delay of a document was derived from
+ */
+struct DebounceStats
+{
+    int delay_ms = 0;                   // delay applied before the next parse
+    double parse_ms = 0;                // moving average of parse durations
+    double edit_interval_ms = 0;        // moving average of intervals between edits
+    int document_length = 0;            // length of the last parsed text
+    int parse_count = 0;
+    int edit_count = 0;
+};
+
+/**
+ * Picks the delay between an edit and its parse from the recent parse
+ * durations and typing cadence of one document: cheap documents are parsed
+ * almost immediately, expensive ones wait until the user pauses typing.
+ *
+ * Thread safe; edits are recorded by the GUI thread and parses by the worker.
+ */
+class AdaptiveDebouncer
+{
+private:
+    mutable QMutex _mutex;
+    QElapsedTimer _since_last_edit;
+    DebounceStats _stats;
+
+public:
+    void edit_arrived();
+    void parse_finished(qint64 elapsed_ms, int document_length);
+
+    int delay() const;
+    DebounceStats stats() const;
+
+private:
+    void update_delay();
+};
+
+}
+
+#endif
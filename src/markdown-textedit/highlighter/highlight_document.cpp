@@ -0,0 +1,84 @@
+﻿
+#include <QElapsedTimer>
+
+#include "highlight_document.h"
+#include "highlight_service.h"
+
+// Documents shorter than this are parsed as a whole right away, longer ones
+// around the focus first
+#define VIEWPORT_PRIORITY_MIN_LENGTH (32 * 1024)
+
+namespace mdtextedit
+{
+
+HighlightDocument::HighlightDocument(HighlightService *service, QObject *parent)
+    : QObject(parent), _service(service)
+{
+    _service->add(this);
+}
+
+HighlightDocument::~HighlightDocument()
+{
+    // waits for a running parse of this document to stop
+    _service->remove(this);
+}
+
+void HighlightDocument::enqueue(const QString &text, const TextChange& change,
+                                unsigned long offset, int focus, long revision)
+{
+    // only edits tell the typing cadence, snapshots taken after a reset() do not
+    if (!change.is_full() && !change.is_empty())
+        _debouncer.edit_arrived();
+    _service->enqueue(this, Task {text, change, offset, focus, revision});
+}
+
+void HighlightDocument::enqueue_edit(const TextChange& change, const QString& added,
+                                     unsigned long offset, int focus, long revision)
+{
+    _debouncer.edit_arrived();
+    _service->enqueue_edit(this, Task {QString(), change, offset, focus, revision}, added);
+}
+
+void HighlightDocument::set_visible(bool visible)
+{
+    _service->set_visible(this, visible);
+}
+
+DebounceStats HighlightDocument::debounce_stats() const
+{
+    return _debouncer.stats();
+}
+
+/**
+ * Parse on a worker thread; returns false if the parse was cancelled
+ */
+bool HighlightDocument::run_task(const Task& task)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // A full parse of a long document keeps the viewport unstyled for a
+    // while; the blocks around the focus are parsed on their own before
+    if (task.focus >= 0 && task.text.length() >= VIEWPORT_PRIORITY_MIN_LENGTH &&
+        _parser.is_full_parse(task.text, task.change))
+    {
+        HighlightElements window;
+        int begin = 0, end = 0;
+        if (!IncrementalParser::parse_window(task.text, task.focus, &_cancel_parse, &window,
+                                             &begin, &end))
+            return false;
+        emit window_ready(window, task.offset, begin, end, task.revision);
+
+        // the delay only defers the parse below, so only that is measured
+        timer.restart();
+    }
+
+    if (!_parser.parse(task.text, task.change, &_cancel_parse))
+        return false;
+    _debouncer.parse_finished(timer.elapsed(), task.text.length());
+
+    emit result_ready(_parser.elements(), task.offset, task.revision);
+    return true;
+}
+
+}
@@ -0,0 +1,87 @@
+﻿
+#ifndef ___HEADFILE_6CAE18CE_21B6_4195_9913_91E841C9BE11_
+#define ___HEADFILE_6CAE18CE_21B6_4195_9913_91E841C9BE11_
+
+#include <QObject>
+#include <QAtomicInt>
+
+#include "incremental_parser.h"
+#include "adaptive_debouncer.h"
+
+namespace mdtextedit
+{
+
+class HighlightService;
+
+struct Task
+{
+    QString text;   // copied from the document's text when a worker takes the task
+    TextChange change;
+    unsigned long offset;
+    int focus;      // first visible position, highlighted first; -1 if unknown
+    long revision;  // revision of the highlighter the text was taken at
+};
+
+/**
+ * Highlighting state of one document, parsed by the worker threads of a
+ * HighlightService. At most one task of a document is pending and at most one
+ * is parsed at a time; newer tasks replace the pending one and cancel the
+ * running one.
+ */
+class HighlightDocument : public QObject
+{
+    Q_OBJECT
+
+    friend class HighlightService;
+
+private:
+    HighlightService *_service = NULL;
+
+    // Guarded by the mutex of the service
+    Task _task;
+    QString _text;          // text of the newest task, edited in place
+    bool _has_task = false;
+    qint64 _due = 0;        // when the pending task may be parsed, on the service clock
+    bool _running = false;
+    bool _visible = false;
+    qint64 _served = 0;     // serial number of the last task taken, for fairness
+
+    // Only used by the thread parsing this document
+    IncrementalParser _parser;
+
+    AdaptiveDebouncer _debouncer;
+    QAtomicInt _cancel_parse; // set when a new task makes the running parse obsolete
+
+public:
+    explicit HighlightDocument(HighlightService *service, QObject *parent = 0);
+    ~HighlightDocument();
+
+    void enqueue(const QString &text, const TextChange& change = TextChange(),
+                 unsigned long offset = 0, int focus = -1, long revision = 0);
+
+    // Enqueue the text last enqueued with 'change' made to it, which added
+    // 'added'; saves the caller a copy of the whole text per edit
+    void enqueue_edit(const TextChange& change, const QString& added,
+                      unsigned long offset = 0, int focus = -1, long revision = 0);
+
+    // Visible documents are parsed before hidden ones
+    void set_visible(bool visible);
+
+    // Delay currently applied before parsing, and what it is based on
+    DebounceStats debounce_stats() const;
+
+signals:
+    void result_ready(const HighlightElements& elements, unsigned long offset, long revision);
+
+    // Elements of the text in [begin, end) only, parsed ahead of the whole
+    // document; positions are those of the whole text like in result_ready()
+    void window_ready(const HighlightElements& elements, unsigned long offset,
+                      int begin, int end, long revision);
+
+private:
+    bool run_task(const Task& task);
+};
+
+}
+
+#endif
@@ -0,0 +1,203 @@
+﻿
+#include <QThread>
+
+#include "highlight_service.h"
+#include "highlight_worker_thread.h"
+
+namespace mdtextedit
+{
+
+Q_GLOBAL_STATIC_WITH_ARGS(HighlightService, global_service,
+                          (QThread::idealThreadCount()))
+
+HighlightService::HighlightService(int thread_count)
+    : _thread_count(qMax(thread_count, 1))
+{
+    _clock.start();
+}
+
+HighlightService::~HighlightService()
+{
+    {
+        QMutexLocker locker(&_mutex);
+        _stopping = true;
+        for (HighlightDocument *document : _documents)
+            document->_cancel_parse.storeRelease(1);
+        _wake.wakeAll();
+    }
+
+    for (HighlightWorkerThread *thread : _threads)
+    {
+        thread->wait();
+        delete thread;
+    }
+}
+
+HighlightService* HighlightService::global()
+{
+    return global_service();
+}
+
+int HighlightService::thread_count() const
+{
+    return _thread_count;
+}
+
+void HighlightService::add(HighlightDocument *document)
+{
+    QMutexLocker locker(&_mutex);
+    _documents.append(document);
+
+    // threads are started with the first document
+    while (_threads.size() < _thread_count)
+    {
+        HighlightWorkerThread *thread = new HighlightWorkerThread(this);
+        _threads.append(thread);
+        thread->start();
+    }
+}
+
+void HighlightService::remove(HighlightDocument *document)
+{
+    QMutexLocker locker(&_mutex);
+    _documents.removeOne(document);
+    document->_cancel_parse.storeRelease(1);
+    while (document->_running)
+        _done.wait(&_mutex);
+}
+
+void HighlightService::enqueue(HighlightDocument *document, const Task& task)
+{
+    QMutexLocker locker(&_mutex);
+    document->_text = task.text;
+    enqueue_locked(document, task);
+}
+
+/**
+ * Enqueue the text of the last task with the edit of 'task' made to it, which
+ * added 'added'. The text is edited in place; only a worker starting on the
+ * task copies it.
+ */
+void HighlightService::enqueue_edit(HighlightDocument *document, const Task& task,
+                                    const QString& added)
+{
+    QMutexLocker locker(&_mutex);
+    document->_text.replace(task.change.position, task.change.removed, added);
+    enqueue_locked(document, task);
+}
+
+void HighlightService::enqueue_locked(HighlightDocument *document, const Task& task)
+{
+    // fold the edit of a skipped task into the new one, so that the change is
+    // relative to the last parsed text
+    Task next = task;
+    next.text = QString(); // taken from _text by the worker
+    if (document->_has_task)
+    {
+        TextChange change = document->_task.change;
+        change.merge(next.change);
+        next.change = change;
+    }
+    document->_task = next;
+    document->_has_task = true;
+
+    // delay processing to see if more tasks are coming (e.g. because the
+    // user is typing fast); the delay grows with the parse costs. Loading or
+    // replacing the whole text is no typing, it is parsed right away.
+    const bool replaced = next.change.is_full() ||
+        next.change.added > document->_text.length() / 2;
+    document->_due = _clock.elapsed() + (replaced ? 0 : document->_debouncer.delay());
+
+    if (document->_running)
+        document->_cancel_parse.storeRelease(1);
+    _wake.wakeAll();
+}
+
+void HighlightService::set_visible(HighlightDocument *document, bool visible)
+{
+    QMutexLocker locker(&_mutex);
+    document->_visible = visible;
+}
+
+/**
+ * Loop of the worker threads
+ */
+void HighlightService::work()
+{
+    QMutexLocker locker(&_mutex);
+    while (!_stopping)
+    {
+        qint64 wait_ms = -1;
+        HighlightDocument *document = next_document(_clock.elapsed(), &wait_ms);
+        if (NULL == document)
+        {
+            if (wait_ms < 0)
+                _wake.wait(&_mutex);
+            else
+                _wake.wait(&_mutex, (unsigned long) wait_ms);
+            continue;
+        }
+
+        // a deep copy, which the next edit of the document's text leaves alone
+        Task task = document->_task;
+        task.text = QString(document->_text.constData(), document->_text.length());
+        document->_has_task = false;
+        document->_running = true;
+        document->_served = ++_serial;
+        document->_cancel_parse.storeRelease(0);
+
+        locker.unlock();
+        const bool finished = document->run_task(task);
+        locker.relock();
+
+        // a cancelled parse leaves the parser at the previous text, so its
+        // change has to be folded into the newer task
+        if (!finished)
+        {
+            if (document->_has_task)
+            {
+                TextChange change = task.change;
+                change.merge(document->_task.change);
+                document->_task.change = change;
+            }
+            else
+            {
+                document->_task = task;
+                document->_task.text = QString();
+                document->_has_task = true;
+            }
+        }
+
+        document->_running = false;
+        _done.wakeAll();
+    }
+}
+
+/**
+ * Pick the document to parse next; if none is due, 'wait_ms' is set to the
+ * time until the next one is, or -1 if there is none
+ */
+HighlightDocument* HighlightService::next_document(qint64 now, qint64 *wait_ms) const
+{
+    HighlightDocument *best = NULL;
+    for (HighlightDocument *document : _documents)
+    {
+        if (!document->_has_task || document->_running)
+            continue;
+
+        if (document->_due > now)
+        {
+            const qint64 wait = document->_due - now;
+            if (*wait_ms < 0 || wait < *wait_ms)
+                *wait_ms = wait;
+            continue;
+        }
+
+        if (NULL == best || (document->_visible && !best->_visible) ||
+            (document->_visible == best->_visible && document->_served < best->_served))
+            best = document;
+    }
+    return best;
+}
+
+}
@@ -0,0 +1,65 @@
+﻿
+#ifndef ___HEADFILE_234FE415_02FE_4854_8C95_A3718C5CB01B_
+#define ___HEADFILE_234FE415_02FE_4854_8C95_A3718C5CB01B_
+
+#include <QList>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+
+#include "highlight_document.h"
+
+namespace mdtextedit
+{
+
+class HighlightWorkerThread;
+
+/**
+ * A pool of worker threads parsing the documents registered to it.
+ *
+ * Ready documents are served visible ones first, then the one served least
+ * recently, and each document has at most one parse running at a time, so
+ * that a big document can not starve the others. The global service is
+ * shared by all highlighters and sized to the core count.
+ */
+class HighlightService
+{
+    friend class HighlightDocument;
+    friend class HighlightWorkerThread;
+
+private:
+    QMutex _mutex;
+    QWaitCondition _wake;           // tasks changed or stopping
+    QWaitCondition _done;           // a document finished parsing
+    QElapsedTimer _clock;
+    QList<HighlightDocument*> _documents;
+    QVector<HighlightWorkerThread*> _threads;
+    int _thread_count;
+    qint64 _serial = 0;
+    bool _stopping = false;
+
+public:
+    explicit HighlightService(int thread_count);
+    ~HighlightService();
+
+    // The process-wide service
+    static HighlightService* global();
+
+    int thread_count() const;
+
+private:
+    void add(HighlightDocument *document);
+    void remove(HighlightDocument *document);
+    void enqueue(HighlightDocument *document, const Task& task);
+    void enqueue_edit(HighlightDocument *document, const Task& task, const QString& added);
+    void enqueue_locked(HighlightDocument *document, const Task& task);
+    void set_visible(HighlightDocument *document, bool visible);
+
+    void work();
+    HighlightDocument* next_document(qint64 now, qint64 *wait_ms) const;
+};
+
+}
+
+#endif
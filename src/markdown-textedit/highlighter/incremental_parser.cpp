@@ -0,0 +1,760 @@
+﻿
+#include <algorithm>
+#include <limits.h>
+#include <QThread>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#   include <peg-markdown-highlight/pmh_parser_ext.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include "incremental_parser.h"
+
+// Documents shorter than this are always parsed as a whole; the incremental
+// path only pays off for big documents
+#define INCREMENTAL_PARSE_MIN_LENGTH (32 * 1024)
+
+// Text parsed by parse_window() behind its focus, and the most context
+// taken in to reach block boundaries on either side
+#define WINDOW_LENGTH (16 * 1024)
+#define WINDOW_CONTEXT_LENGTH (4 * 1024)
+
+// Time a parse may take before it leaves the rest of the text unparsed; the
+// window is parsed to show something quickly
+#define PARSE_BUDGET_MS 2000
+#define WINDOW_PARSE_BUDGET_MS 200
+
+namespace mdtextedit
+{
+
+TextChange::TextChange()
+    : position(-1), removed(0), added(0)
+{}
+
+TextChange::TextChange(int pos, int chars_removed, int chars_added)
+    : position(pos), removed(chars_removed), added(chars_added)
+{}
+
+bool TextChange::is_full() const
+{
+    return position < 0;
+}
+
+bool TextChange::is_empty() const
+{
+    return position >= 0 && 0 == removed && 0 == added;
+}
+
+void TextChange::merge(const TextChange& next)
+{
+    if (is_full() || next.is_empty())
+        return;
+
+    if (next.is_full() || is_empty())
+    {
+        *this = next;
+        return;
+    }
+
+    // Union of both ranges in the coordinates between the two edits, then
+    // mapped back to the text before the first edit and after the second one
+    const int old_end = position + removed, mid_end = position + added;
+    const int start = qMin(position, next.position);
+    const int union_end = qMax(mid_end, next.position + next.removed);
+    removed = union_end + (old_end - mid_end) - start;
+    added = union_end + (next.added - next.removed) - start;
+    position = start;
+}
+
+long map_position(long position, const TextChange& change)
+{
+    if (position < change.position)
+        return position;
+    if (position < change.position + change.removed)
+        return change.position;
+    return position + change.added - change.removed;
+}
+
+bool changed_range(const HighlightElements& older, unsigned long older_offset,
+                   const HighlightElements& newer, unsigned long newer_offset,
+                   const TextChange& change, long *begin, long *end)
+{
+    const long shift = change.added - change.removed;
+    const int common = qMin(older.size(), newer.size());
+
+    int prefix = 0;
+    while (prefix < common)
+    {
+        const HighlightElement& o = older.at(prefix), & n = newer.at(prefix);
+        const long pos = n.pos + newer_offset, end_pos = n.end + newer_offset;
+        if (o.type != n.type || (long) (o.pos + older_offset) != pos ||
+            (long) (o.end + older_offset) != end_pos || o.address != n.address ||
+            (!change.is_empty() && end_pos > change.position))
+            break;
+        ++prefix;
+    }
+
+    int suffix = 0;
+    while (suffix < common - prefix)
+    {
+        const HighlightElement& o = older.at(older.size() - 1 - suffix),
+            & n = newer.at(newer.size() - 1 - suffix);
+        const long pos = o.pos + older_offset, end_pos = o.end + older_offset;
+        if (o.type != n.type || pos + shift != (long) (n.pos + newer_offset) ||
+            end_pos + shift != (long) (n.end + newer_offset) || o.address != n.address ||
+            (!change.is_empty() && pos < change.position + change.removed))
+            break;
+        ++suffix;
+    }
+
+    bool changed = false;
+    if (!change.is_empty())
+    {
+        *begin = change.position;
+        *end = change.position + change.added;
+        changed = true;
+    }
+    for (int i = prefix; i < older.size() - suffix; ++i)
+    {
+        const long pos = map_position(older.at(i).pos + older_offset, change),
+            end_pos = map_position(older.at(i).end + older_offset, change);
+        *begin = (changed ? qMin(*begin, pos) : pos);
+        *end = (changed ? qMax(*end, end_pos) : end_pos);
+        changed = true;
+    }
+    for (int i = prefix; i < newer.size() - suffix; ++i)
+    {
+        const long pos = newer.at(i).pos + newer_offset, end_pos = newer.at(i).end + newer_offset;
+        *begin = (changed ? qMin(*begin, pos) : pos);
+        *end = (changed ? qMax(*end, end_pos) : end_pos);
+        changed = true;
+    }
+    return changed;
+}
+
+static bool element_less(const HighlightElement& a, const HighlightElement& b)
+{
+    if (a.pos != b.pos)
+        return a.pos < b.pos;
+    if (a.end != b.end)
+        return a.end < b.end;
+    return a.type < b.type;
+}
+
+static bool is_blank(QChar c)
+{
+    return ' ' == c || '\t' == c;
+}
+
+/**
+ * Whether 'pos' starts a top-level block: a line that follows a blank line
+ * and can not continue a list, blockquote, verbatim or HTML block above it
+ */
+static bool is_block_start(const QString& text, int pos)
+{
+    const int len = text.length();
+    if (pos <= 0 || pos >= len)
+        return true;
+    if ('\n' != text.at(pos - 1))
+        return false;
+
+    // previous line must be blank
+    for (int i = pos - 2; i >= 0 && '\n' != text.at(i); --i)
+    {
+        if (!is_blank(text.at(i)))
+            return false;
+    }
+
+    // no indention, blank line, blockquote or HTML
+    const QChar c = text.at(pos);
+    if (is_blank(c) || '\n' == c || '>' == c || '<' == c)
+        return false;
+
+    // no bullet list item
+    if (('*' == c || '-' == c || '+' == c) &&
+        (pos + 1 >= len || is_blank(text.at(pos + 1)) || '\n' == text.at(pos + 1)))
+        return false;
+
+    // no ordered list item
+    int i = pos;
+    while (i < len && '0' <= text.at(i) && text.at(i) <= '9')
+        ++i;
+    if (i > pos && i < len && '.' == text.at(i))
+        return false;
+
+    return true;
+}
+
+// Tags that open an HTML block, which may span blank lines
+static const char *const HTML_BLOCK_TAGS[] = {
+    "address", "blockquote", "center", "dd", "dir", "div", "dl", "dt",
+    "fieldset", "form", "frameset", "h1", "h2", "h3", "h4", "h5", "h6", "head",
+    "hr", "isindex", "li", "menu", "noframes", "noscript", "ol", "p", "pre",
+    "script", "style", "table", "tbody", "td", "tfoot", "th", "thead", "tr",
+    "ul", NULL
+};
+
+static bool contains(const QString& text, int begin, int end, const char *s)
+{
+    return text.midRef(begin, end - begin).contains(QLatin1String(s));
+}
+
+/**
+ * Whether the line at 'pos' starts with an HTML block tag
+ */
+static bool is_html_block_line(const QString& text, int pos)
+{
+    const int len = text.length();
+    if (pos >= len || '<' != text.at(pos))
+        return false;
+
+    int i = pos + 1;
+    if (i < len && '/' == text.at(i))
+        ++i;
+    const int name_start = i;
+    while (i < len && text.at(i).isLetterOrNumber())
+        ++i;
+
+    const QString name = text.mid(name_start, i - name_start).toLower();
+    for (const char *const *tag = HTML_BLOCK_TAGS; *tag != NULL; ++tag)
+    {
+        if (name == QLatin1String(*tag))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Whether text in [begin, end) contains syntax that may change the
+ * highlighting outside of its own block: reference definitions, HTML blocks
+ * and comments
+ */
+static bool has_cross_block_syntax(const QString& text, int begin, int end)
+{
+    if (contains(text, begin, end, "]:") || contains(text, begin, end, "<!--") ||
+        contains(text, begin, end, "-->"))
+        return true;
+
+    int line = begin;
+    while (line >= 0 && line < end)
+    {
+        if (is_html_block_line(text, line))
+            return true;
+        line = text.indexOf('\n', line);
+        if (line >= 0)
+            ++line;
+    }
+    return false;
+}
+
+static int line_start(const QString& text, int pos)
+{
+    return pos > 0 ? text.lastIndexOf('\n', pos - 1) + 1 : 0;
+}
+
+static int line_end(const QString& text, int pos)
+{
+    const int i = text.indexOf('\n', pos);
+    return i < 0 ? text.length() : i;
+}
+
+/**
+ * Whether a definition may follow the line starting at 'pos': the parser
+ * collects them behind blank lines, headings and other definitions only
+ */
+static bool may_precede_definition(const QString& text, int pos, const QVector<int>& definitions)
+{
+    if (!definitions.isEmpty() && definitions.last() == pos)
+        return true;
+
+    const int end = line_end(text, pos);
+    if (pos == end || '#' == text.at(pos))
+        return true;
+
+    // blank line or setext underline
+    bool blank = true, underline = true;
+    for (int i = pos; i < end; ++i)
+    {
+        blank = blank && is_blank(text.at(i));
+        underline = underline && text.at(i) == text.at(pos);
+    }
+    return blank || (underline && ('=' == text.at(pos) || '-' == text.at(pos)));
+}
+
+/**
+ * Whether the line ending at 'end' is a definition, given that "]:" at
+ * 'colon' ends its label: a URL and an optional quoted title follow
+ */
+static bool is_definition_tail(const QString& text, int colon, int end)
+{
+    int i = colon + 2;
+    while (i < end && is_blank(text.at(i)))
+        ++i;
+    const int url = i;
+    while (i < end && !is_blank(text.at(i)))
+        ++i;
+    if (url == i)
+        return false;
+
+    while (i < end && is_blank(text.at(i)))
+        ++i;
+    int last = end - 1;
+    while (last > i && is_blank(text.at(last)))
+        --last;
+    if (i == end)
+        return true;
+    const QChar open = text.at(i), close = text.at(last);
+    return last > i && (('"' == open && '"' == close) || ('\'' == open && '\'' == close) ||
+                        ('(' == open && ')' == close));
+}
+
+/**
+ * Append the starts of all lines of 'text' in [begin, end) that define
+ * references ("[label]: url") to 'out'
+ */
+static void find_reference_definitions(const QString& text, int begin, int end,
+                                       QVector<int> *out)
+{
+    const QStringRef region = text.midRef(begin, end - begin);
+    int found = region.indexOf(QLatin1String("]:"));
+    while (found >= 0)
+    {
+        const int i = begin + found;
+        const int start = text.lastIndexOf('\n', i) + 1;
+        const int end_of_line = line_end(text, i);
+
+        int indent = start;
+        while (indent < i && ' ' == text.at(indent) && indent - start < 3)
+            ++indent;
+        if (begin <= start && end_of_line <= end && '[' == text.at(indent) &&
+            is_definition_tail(text, i, end_of_line) &&
+            (0 == start || may_precede_definition(text, line_start(text, start - 1), *out)))
+            out->append(start);
+
+        found = region.indexOf(QLatin1String("]:"), end_of_line - begin);
+    }
+}
+
+/**
+ * Append the lines of 'text' starting at 'lines' [first, last) to 'out', each
+ * followed by a blank line
+ */
+static void append_lines(const QString& text, const QVector<int>& lines, int first, int last,
+                         QString *out)
+{
+    for (int i = first; i < last; ++i)
+    {
+        const int start = lines.at(i);
+        *out += text.midRef(start, line_end(text, start) - start);
+        *out += "\n\n";
+    }
+}
+
+/**
+ * Replace the items [from, to) of 'v' with 'items', moving the ones behind
+ */
+template <typename T>
+static void splice(QVector<T> *v, int from, int to, const QVector<T>& items)
+{
+    const int common = qMin(to - from, items.size());
+    for (int i = 0; i < common; ++i)
+        (*v)[from + i] = items.at(i);
+    if (items.size() > common)
+        v->insert(from + common, items.size() - common, T());
+    else
+        v->remove(from + common, to - from - common);
+    for (int i = common; i < items.size(); ++i)
+        (*v)[from + i] = items.at(i);
+}
+
+static int count_unparsed(const HighlightElements& elements, int from, int to)
+{
+    int count = 0;
+    for (int i = from; i < to; ++i)
+    {
+        if (UNPARSED_ELEMENT == elements.at(i).type)
+            ++count;
+    }
+    return count;
+}
+
+static bool is_cancelled(void *context)
+{
+    return 0 != static_cast<const QAtomicInt*>(context)->loadAcquire();
+}
+
+/**
+ * Whether [pos, end) overlaps one of 'ranges', which are sorted and disjoint
+ */
+static bool overlaps(const HighlightElements& ranges, unsigned long pos, unsigned long end)
+{
+    HighlightElement key;
+    key.pos = end;
+    const HighlightElements::const_iterator next = std::lower_bound(
+        ranges.begin(), ranges.end(), key,
+        [] (const HighlightElement& a, const HighlightElement& b) { return a.pos < b.pos; });
+    return next != ranges.begin() && (next - 1)->end > pos;
+}
+
+/**
+ * Parse 'text' and append the elements starting in [first, limit) to 'out',
+ * moved from 'first' to 'offset' and sorted. Returns false if cancelled.
+ */
+static bool parse_text(const QString& text, unsigned long first, unsigned long limit,
+                       unsigned long offset, int budget_ms, const QAtomicInt *cancel,
+                       HighlightElements *out)
+{
+    // memoization keeps pasted text full of unclosed brackets and emphasis
+    // markers from keeping the worker thread busy for minutes
+    pmh_parse_budget budget;
+    budget.max_steps = 0;
+    budget.max_msecs = budget_ms;
+    pmh_flat_elements *flat = NULL;
+    // Long texts are parsed in chunks on all cores, short ones on this thread;
+    // the helper threads are a pool the workers of all documents share. The
+    // parser reads the UTF-16 as it is, and its offsets are positions in it
+    if (!::pmh_markdown_utf16_to_flat_elements(
+            text.utf16(), text.length(), pmh_EXT_MEMOIZE,
+            QThread::idealThreadCount(), &budget,
+            (NULL == cancel ? NULL : is_cancelled), const_cast<QAtomicInt*>(cancel),
+            &flat))
+        return false;
+
+    // Text the parse did not get to is shown plain, also where the elements
+    // of enclosing blocks reach into it
+    HighlightElements unparsed_ranges;
+    for (size_t i = 0; i < flat->unparsed_count; ++i)
+    {
+        HighlightElement e;
+        e.type = UNPARSED_ELEMENT;
+        e.pos = qMax(flat->unparsed_pos[i], first);
+        e.end = qMin(flat->unparsed_end[i], limit);
+        if (e.pos < e.end)
+            unparsed_ranges.append(e);
+    }
+
+    // Both come sorted, so they are merged; only elements cut at 'limit' may
+    // end up out of order
+    const int head = out->size();
+    bool cut = false;
+    int next_unparsed = 0;
+    for (size_t i = 0; i <= flat->count; ++i)
+    {
+        const bool at_end = (i == flat->count);
+        while (next_unparsed < unparsed_ranges.size() &&
+               (at_end || unparsed_ranges.at(next_unparsed).pos <= flat->pos[i]))
+        {
+            HighlightElement e = unparsed_ranges.at(next_unparsed++);
+            e.pos = e.pos - first + offset;
+            e.end = e.end - first + offset;
+            out->append(e);
+        }
+        if (at_end)
+            break;
+
+        // empty (or broken, end before pos) elements would never be applied
+        const unsigned long pos = flat->pos[i], end = flat->end[i];
+        if (pos < first || limit <= pos || end <= pos ||
+            overlaps(unparsed_ranges, pos, end))
+            continue;
+
+        HighlightElement e;
+        e.type = (pmh_element_type) flat->types[i];
+        e.pos = pos - first + offset;
+        e.end = qMin(end, limit) - first + offset;
+        cut = cut || end > limit;
+        if (0 != (flat->flags[i] & pmh_FLAT_ADDRESS))
+            e.address = text.mid((int) flat->address_pos[i],
+                                 (int) (flat->address_end[i] - flat->address_pos[i]));
+        out->append(e);
+    }
+    if (cut)
+        std::sort(out->begin() + head, out->end(), element_less);
+
+    ::pmh_free_flat_elements(flat);
+    return true;
+}
+
+bool IncrementalParser::is_full_parse(const QString& text, const TextChange& change) const
+{
+    const int old_len = _text.length(), new_len = text.length();
+    return _text.isNull() || change.is_full() ||
+        new_len < INCREMENTAL_PARSE_MIN_LENGTH ||
+        change.position + change.removed > old_len ||
+        old_len - change.removed + change.added != new_len ||
+        change.added > new_len / 2;
+}
+
+bool IncrementalParser::parse(const QString& text, const TextChange& change,
+                              const QAtomicInt *cancel)
+{
+    const int new_len = text.length();
+    _scanned_begin = _scanned_end = 0;
+    if (is_full_parse(text, change))
+        return parse_full(text, cancel);
+
+    int begin = 0, end = 0;
+    if (!change.is_empty())
+    {
+        const int delta = change.added - change.removed;
+        expand_to_blocks(text, change.position, change.position + change.added, delta,
+                         &begin, &end);
+
+        // The edited lines must not add or remove syntax reaching beyond their
+        // block, neither in the old nor in the new text. This includes the lines
+        // around them: a reference definition there stops or starts being one
+        // when the edit adds or removes a blank line next to it.
+        const int check_start = line_start(text, line_start(text, change.position) - 1);
+        const int check_end = line_end(text, line_end(text, change.position + change.added) + 1);
+        scanned(check_start, check_end);
+        if (end - begin > new_len / 2 ||
+            has_cross_block_syntax(text, check_start, check_end) ||
+            has_cross_block_syntax(_text, check_start,
+                                   line_end(_text, line_end(_text, change.position + change.removed) + 1)))
+        {
+            return parse_full(text, cancel);
+        }
+
+        if (!parse_region(text, begin, end, delta, cancel))
+            return false;
+    }
+
+    // Text earlier parses ran out of time for is parsed again, from the first
+    // to the last of it: parses run out of time at one point, or at one point
+    // in each chunk of the text, and leave all that follows. The edit is in
+    // already, so a cancelled parse leaves that text for the next one.
+    int first_unparsed = -1, last_unparsed = -1;
+    for (int i = 0; _unparsed_count > 0 && i < _elements.size(); ++i)
+    {
+        const HighlightElement& e = _elements.at(i);
+        if (UNPARSED_ELEMENT == e.type && ((int) e.pos < begin || (int) e.end > end))
+        {
+            if (first_unparsed < 0)
+                first_unparsed = i;
+            last_unparsed = i;
+        }
+    }
+    if (first_unparsed >= 0)
+    {
+        int unparsed_begin = 0, unparsed_end = 0;
+        expand_to_blocks(text, (int) _elements.at(first_unparsed).pos,
+                         (int) _elements.at(last_unparsed).end, 0, &unparsed_begin, &unparsed_end);
+        parse_region(text, unparsed_begin, unparsed_end, 0, cancel);
+    }
+    return true;
+}
+
+/**
+ * Expand [from, to) of the new text to the top-level blocks enclosing it,
+ * where the old elements, moved by 'delta' behind 'to', can be cut
+ */
+void IncrementalParser::expand_to_blocks(const QString& text, int from, int to, int delta,
+                                         int *begin, int *end) const
+{
+    const int len = text.length();
+
+    // Expand backwards to the start of the enclosing top-level block. Text
+    // before 'from' is unchanged, so old elements are valid up to there.
+    *begin = line_start(text, from);
+    while (*begin > 0 && !(is_block_start(text, *begin) && is_clean_cut(*begin)))
+        *begin = line_start(text, *begin - 1);
+
+    // Expand forwards to the next top-level block; the blank line in front of
+    // it must lie completely behind 'to'
+    *end = len;
+    int prev_newline = text.indexOf('\n', to);
+    while (prev_newline >= 0 && prev_newline + 1 < len)
+    {
+        const int newline = text.indexOf('\n', prev_newline + 1);
+        if (newline < 0 || newline + 1 >= len)
+            break;
+        if (is_block_start(text, newline + 1) && is_clean_cut(newline + 1 - delta))
+        {
+            *end = newline + 1;
+            break;
+        }
+        prev_newline = newline;
+    }
+}
+
+/**
+ * Parse [begin, end) of the new text again, which is [begin, end - delta) of
+ * the old one, and move the elements and definitions behind it by 'delta'
+ */
+bool IncrementalParser::parse_region(const QString& text, int begin, int end, int delta,
+                                     const QAtomicInt *cancel)
+{
+    const int old_region_end = end - delta;
+    const int head = lower_bound(begin);
+    const int tail = lower_bound(old_region_end);
+    scanned(begin, end);
+
+    // Reference links inside the region may point to definitions anywhere in
+    // the document. Surround the region with those, keeping the document
+    // order so that the same definition wins for duplicated labels. Lines
+    // outside of the region are the same in the old text.
+    const int first_definition = std::lower_bound(
+        _reference_definitions.begin(), _reference_definitions.end(), begin) -
+        _reference_definitions.begin();
+    const int last_definition = std::lower_bound(
+        _reference_definitions.begin(), _reference_definitions.end(), old_region_end) -
+        _reference_definitions.begin();
+    const bool has_links = text.midRef(begin, end - begin).contains('[');
+    QString fragment;
+    if (has_links)
+        append_lines(_text, _reference_definitions, 0, first_definition, &fragment);
+    const unsigned long first = fragment.length();
+    fragment += text.midRef(begin, end - begin);
+    const unsigned long limit = fragment.length();
+    if (has_links)
+    {
+        fragment += "\n\n";
+        append_lines(_text, _reference_definitions, last_definition,
+                     _reference_definitions.size(), &fragment);
+    }
+
+    HighlightElements elements;
+    if (!parse_text(fragment, first, limit, begin, PARSE_BUDGET_MS, cancel, &elements))
+        return false;
+
+    // Only the region is replaced, and only what follows it is moved
+    _unparsed_count += count_unparsed(elements, 0, elements.size()) -
+        count_unparsed(_elements, head, tail);
+    splice(&_elements, head, tail, elements);
+    for (int i = head + elements.size(); i < _elements.size(); ++i)
+    {
+        HighlightElement& e = _elements[i];
+        e.pos += delta;
+        e.end += delta;
+    }
+    update_index(head);
+
+    QVector<int> definitions;
+    find_reference_definitions(text, begin, end, &definitions);
+    splice(&_reference_definitions, first_definition, last_definition, definitions);
+    for (int i = first_definition + definitions.size(); i < _reference_definitions.size(); ++i)
+        _reference_definitions[i] += delta;
+
+    _text = text;
+    return true;
+}
+
+void IncrementalParser::scanned(int begin, int end)
+{
+    if (_scanned_begin < _scanned_end)
+    {
+        _scanned_begin = qMin(_scanned_begin, begin);
+        _scanned_end = qMax(_scanned_end, end);
+    }
+    else
+    {
+        _scanned_begin = begin;
+        _scanned_end = end;
+    }
+}
+
+void IncrementalParser::scanned_range(int *begin, int *end) const
+{
+    *begin = _scanned_begin;
+    *end = _scanned_end;
+}
+
+const HighlightElements& IncrementalParser::elements() const
+{
+    return _elements;
+}
+
+bool IncrementalParser::parse_window(const QString& text, int focus, const QAtomicInt *cancel,
+                                     HighlightElements *out, int *window_begin, int *window_end)
+{
+    const int len = text.length();
+    focus = qBound(0, focus, len);
+
+    // Start at the top-level block enclosing the focus, end at the first one
+    // behind the window. Blocks longer than the context are cut, which may
+    // get their highlighting wrong until the whole document is parsed.
+    const int min_begin = qMax(0, focus - WINDOW_CONTEXT_LENGTH);
+    int begin = line_start(text, focus);
+    while (begin > min_begin && !is_block_start(text, begin))
+        begin = line_start(text, begin - 1);
+    begin = qMax(begin, min_begin);
+
+    const int max_end = qMin(len, focus + WINDOW_LENGTH + WINDOW_CONTEXT_LENGTH);
+    int end = qMin(len, focus + WINDOW_LENGTH);
+    while (end < max_end && !is_block_start(text, end))
+        end = line_end(text, end) + 1;
+    end = qMin(end, max_end);
+
+    HighlightElements elements;
+    if (!parse_text(text.mid(begin, end - begin), 0, ULONG_MAX, begin, WINDOW_PARSE_BUDGET_MS,
+                    cancel, &elements))
+        return false;
+    *out = elements;
+    *window_begin = begin;
+    *window_end = end;
+    return true;
+}
+
+void IncrementalParser::reset()
+{
+    _text = QString();
+    _elements.clear();
+    _max_end.clear();
+    _unparsed_count = 0;
+    _reference_definitions.clear();
+    _scanned_begin = _scanned_end = 0;
+}
+
+bool IncrementalParser::parse_full(const QString& text, const QAtomicInt *cancel)
+{
+    HighlightElements elements;
+    if (!parse_text(text, 0, ULONG_MAX, 0, PARSE_BUDGET_MS, cancel, &elements))
+        return false;
+
+    _text = text;
+    _elements = elements;
+    _scanned_begin = 0;
+    _scanned_end = text.length();
+    update_index(0);
+    _unparsed_count = count_unparsed(_elements, 0, _elements.size());
+    _reference_definitions.clear();
+    find_reference_definitions(text, 0, text.length(), &_reference_definitions);
+    return true;
+}
+
+int IncrementalParser::lower_bound(unsigned long pos) const
+{
+    int lo = 0, hi = _elements.size();
+    while (lo < hi)
+    {
+        const int mid = (lo + hi) / 2;
+        if (_elements.at(mid).pos < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+bool IncrementalParser::is_clean_cut(unsigned long pos) const
+{
+    // no element starting before 'pos' may reach beyond it
+    const int i = lower_bound(pos);
+    return 0 == i || _max_end.at(i - 1) <= pos;
+}
+
+void IncrementalParser::update_index(int first)
+{
+    _max_end.resize(_elements.size());
+    unsigned long max_end = (first > 0 ? _max_end.at(first - 1) : 0);
+    for (int i = first; i < _elements.size(); ++i)
+    {
+        max_end = qMax(max_end, _elements.at(i).end);
+        _max_end[i] = max_end;
+    }
+}
+
+}
@@ -0,0 +1,129 @@
+﻿
+#ifndef ___HEADFILE_B005C4D7_1EE8_4BF7_A011_72346030A366_
+#define ___HEADFILE_B005C4D7_1EE8_4BF7_A011_72346030A366_
+
+#include <QString>
+#include <QVector>
+#include <QMetaType>
+#include <QAtomicInt>
+
+#include <pmh_definitions.h>
+
+namespace mdtextedit
+{
+
+/**
+ * One highlighted element, with offsets relative to the whole document
+ */
+struct HighlightElement
+{
+    pmh_element_type type;
+    unsigned long pos;
+    unsigned long end;
+    QString address;
+};
+
+/**
+ * Elements of a document, sorted by position
+ */
+typedef QVector<HighlightElement> HighlightElements;
+
+/**
+ * Type of the elements covering text that a parse did not get to within its
+ * time budget. No other element reaches into them; the text is shown plain.
+ */
+const pmh_element_type UNPARSED_ELEMENT = pmh_NO_TYPE;
+
+/**
+ * An edit as reported by QTextDocument::contentsChange()
+ *
+ * A negative position means the whole document has to be parsed again, while
+ * an empty change (nothing removed or added) means the text is unchanged.
+ */
+struct TextChange
+{
+    int position;
+    int removed;
+    int added;
+
+    TextChange();
+    TextChange(int position, int removed, int added);
+
+    bool is_full() const;
+    bool is_empty() const;
+
+    // Fold a later edit into this one
+    void merge(const TextChange& next);
+};
+
+// Maps a position of the text before 'change' to the text after it
+long map_position(long position, const TextChange& change);
+
+/**
+ * Finds the range of the document, in positions after 'change', outside of
+ * which 'older' and 'newer' format the text the same way: elements in front
+ * of the change are equal, elements behind it are equal after shifting.
+ * Returns false if there is no such difference.
+ */
+bool changed_range(const HighlightElements& older, unsigned long older_offset,
+                   const HighlightElements& newer, unsigned long newer_offset,
+                   const TextChange& change, long *begin, long *end);
+
+/**
+ * Keeps the result of the last parse, and on the next edit re-parses only the
+ * top-level blocks enclosing the changed range. Elements outside of that range
+ * are kept and shifted.
+ *
+ * A parse may be cancelled by setting the flag passed to parse() to non-zero
+ * from another thread; the previous result is kept then. A parse running out
+ * of time leaves the rest of the text unparsed (see UNPARSED_ELEMENT), and the
+ * next one parses the blocks enclosing that text again along with its edit.
+ */
+class IncrementalParser
+{
+private:
+    QString _text;
+    HighlightElements _elements;
+    QVector<unsigned long> _max_end; // _max_end[i] is the largest end of _elements[0..i]
+    int _unparsed_count = 0;         // elements of type UNPARSED_ELEMENT
+    QVector<int> _reference_definitions; // starts of the lines of _text defining references
+    int _scanned_begin = 0, _scanned_end = 0; // see scanned_range()
+
+public:
+    // Returns false if the parse was cancelled
+    bool parse(const QString& text, const TextChange& change,
+               const QAtomicInt *cancel = NULL);
+    const HighlightElements& elements() const;
+    void reset();
+
+    // Whether parse() would have to parse all of 'text'
+    bool is_full_parse(const QString& text, const TextChange& change) const;
+
+    // Parse only the blocks around 'focus', with a bounded amount of context;
+    // the elements cover the text in [*begin, *end) only
+    static bool parse_window(const QString& text, int focus, const QAtomicInt *cancel,
+                             HighlightElements *out, int *begin, int *end);
+
+    // Range of the text the last parse() searched and parsed, for tests; the
+    // reference definitions it took in from elsewhere are not counted
+    void scanned_range(int *begin, int *end) const;
+
+private:
+    bool parse_full(const QString& text, const QAtomicInt *cancel);
+    void expand_to_blocks(const QString& text, int from, int to, int delta,
+                          int *begin, int *end) const;
+    bool parse_region(const QString& text, int begin, int end, int delta,
+                      const QAtomicInt *cancel);
+    void scanned(int begin, int end);
+    int lower_bound(unsigned long pos) const;
+    bool is_clean_cut(unsigned long pos) const;
+    // Recompute _max_end from element 'first' on
+    void update_index(int first);
+};
+
+}
+
+Q_DECLARE_TYPEINFO(mdtextedit::HighlightElement, Q_MOVABLE_TYPE);
+Q_DECLARE_METATYPE(mdtextedit::HighlightElements)
+
+#endif
@@ -1,7 +1,12 @@
 ﻿
+#include <algorithm>
+
 #include <QDebug>
 #include <QFile>
+#include <QElapsedTimer>
 #include <QTextDocument>
+#include <QTextBlock>
+#include <QTextCursor>
 #include <QTextLayout>
 
 
@@ -16,33 +21,54 @@ extern "C" {
 
 #include "markdown_highlighter.h"
 
+// Time the GUI thread spends on applying a result per event loop turn
+#define APPLY_SLICE_MS 4
+
+// Number of blocks behind the focus position that are applied first
+#define VISIBLE_BLOCK_COUNT 200
+
 using PegMarkdownHighlight::HighlightingStyle;
 
 namespace mdtextedit
 {
 
+static bool dedicated_threads = false;
+
 MarkdownHighlighter::MarkdownHighlighter(QTextDocument *document)
-    : QSyntaxHighlighter(document), _worker_thread(new HighlightWorkerThread(this))
+    : QSyntaxHighlighter(document)
 {
     set_default_styles();
 
-    connect(_worker_thread, SIGNAL(result_ready(pmh_element**, unsigned long)),
-            this, SLOT(result_ready(pmh_element**, unsigned long)));
-
-    _worker_thread->start();
+    HighlightService *service = HighlightService::global();
+    if (dedicated_threads)
+        service = _own_service = new HighlightService(1);
+    _document = new HighlightDocument(service);
+
+    qRegisterMetaType<HighlightElements>("HighlightElements");
+    connect(_document, SIGNAL(result_ready(HighlightElements, unsigned long, long)),
+            this, SLOT(result_ready(HighlightElements, unsigned long, long)));
+    connect(_document, SIGNAL(window_ready(HighlightElements, unsigned long, int, int, long)),
+            this, SLOT(window_ready(HighlightElements, unsigned long, int, int, long)));
+    connect(document, SIGNAL(contentsChange(int, int, int)),
+            this, SLOT(contents_changed(int, int, int)));
+
+    _apply_timer.setSingleShot(true);
+    _apply_timer.setInterval(0);
+    connect(&_apply_timer, SIGNAL(timeout()), this, SLOT(apply_slice()));
 }
 
 MarkdownHighlighter::~MarkdownHighlighter()
 {
-    // stop background worker thread
-    _worker_thread->enqueue(QString());
-    _worker_thread->wait();
-    delete _worker_thread;
+    // stop parsing, then the dedicated thread
+    delete _document;
+    delete _own_service;
 }
 
 void MarkdownHighlighter::reset()
 {
-    _previous_text.clear();
+    // force a new snapshot on next highlightBlock(), and apply it to all blocks
+    _enqueued_revision = -1;
+    _applied_valid = false;
 }
 
 void MarkdownHighlighter::set_styles(const QVector<PegMarkdownHighlight::HighlightingStyle> &styles)
@@ -160,19 +186,126 @@ void MarkdownHighlighter::set_yaml_header_support_enabled(bool enabled)
     _yaml_header_support_enabled = enabled;
 }
 
+DebounceStats MarkdownHighlighter::debounce_stats() const
+{
+    return _document->debounce_stats();
+}
+
+void MarkdownHighlighter::set_visible(bool visible)
+{
+    _document->set_visible(visible);
+}
+
+void MarkdownHighlighter::set_focus_position(int position)
+{
+    _focus_position = position;
+}
+
+void MarkdownHighlighter::set_dedicated_thread_mode(bool enabled)
+{
+    dedicated_threads = enabled;
+}
+
+bool MarkdownHighlighter::dedicated_thread_mode()
+{
+    return dedicated_threads;
+}
+
 void MarkdownHighlighter::highlightBlock(const QString &textBlock)
 {
-    if (document()->isEmpty())
+    Q_UNUSED(textBlock);
+
+    // QSyntaxHighlighter calls us once per block; only the first call after
+    // an edit or a reset() needs to take a snapshot
+    if (_enqueued_revision != _revision)
+        enqueue_snapshot(document()->toPlainText(), TextChange(0, 0, 0));
+
+    // formats of an edited block are outdated until the next result
+    const HighlightBlockData *data = static_cast<HighlightBlockData*>(currentBlockUserData());
+    if (NULL == data || data->block_revision != currentBlock().revision())
+        return;
+
+    for (int i = 0; i < data->formats.size(); ++i)
+    {
+        const QTextLayout::FormatRange& r = data->formats.at(i);
+        setFormat(r.start, r.length, r.format);
+    }
+}
+
+void MarkdownHighlighter::contents_changed(int position, int chars_removed, int chars_added)
+{
+    if (_formatting || (0 == chars_removed && 0 == chars_added))
+        return;
+
+    const TextChange change(position, chars_removed, chars_added);
+    ++_revision;
+    _unapplied_change.merge(change);
+    if (_window_begin >= 0)
+    {
+        _window_begin = map_position(_window_begin, change);
+        _window_end = map_position(_window_end, change);
+    }
+    enqueue_edit(change);
+}
+
+void MarkdownHighlighter::enqueue_edit(const TextChange& change)
+{
+    // The change may include the paragraph separator at the end, which the
+    // plain text leaves out. The YAML header is cut from whole texts only.
+    const int length = document()->characterCount() - 1;
+    if (_text_length < 0 || _yaml_header_support_enabled || document()->isEmpty() ||
+        change.position + change.removed > _text_length ||
+        change.position + change.added > length ||
+        _text_length - change.removed + change.added != length)
+    {
+        enqueue_snapshot(document()->toPlainText(), change);
         return;
+    }
 
-    QString text = document()->toPlainText();
+    QTextCursor cursor(document());
+    cursor.setPosition(change.position);
+    cursor.setPosition(change.position + change.added, QTextCursor::KeepAnchor);
+    QString added = cursor.selectedText();
 
-    // document changed since last call?
-    if (text == _previous_text)
+    // the same replacements toPlainText() makes
+    for (int i = 0; i < added.length(); ++i)
+    {
+        switch (added.at(i).unicode())
+        {
+        case 0xfdd0: // QTextBeginningOfFrame
+        case 0xfdd1: // QTextEndOfFrame
+        case QChar::ParagraphSeparator:
+        case QChar::LineSeparator:
+            added[i] = '\n';
+            break;
+        case QChar::Nbsp:
+            added[i] = ' ';
+            break;
+        }
+    }
+
+    _enqueued_revision = _revision;
+    _text_length = length;
+    const int focus = (_focus_position < 0 ? -1 : _focus_position);
+    _document->enqueue_edit(change, added, 0, focus, _revision);
+}
+
+void MarkdownHighlighter::enqueue_snapshot(const QString& text, const TextChange& change)
+{
+    _enqueued_revision = _revision;
+
+    // an empty document is not parsed, so the next edit has to be enqueued
+    // with all of the text
+    if (document()->isEmpty())
+    {
+        _text_length = -1;
         return;
+    }
+    _text_length = text.length();
 
     // cut YAML headers
     QString actualText;
+    TextChange actualChange = change;
     unsigned long offset = 0;
     if (_yaml_header_support_enabled)
     {
@@ -180,6 +313,7 @@ void MarkdownHighlighter::highlightBlock(const QString &textBlock)
         // YamlHeaderChecker checker(text);
         // actualText = checker.body();
         // offset = checker.bodyOffset();
+        // actualChange = TextChange(); // header may have changed
         actualText = text;
     }
     else
@@ -187,113 +321,323 @@ void MarkdownHighlighter::highlightBlock(const QString &textBlock)
         actualText = text;
     }
 
-    _worker_thread->enqueue(actualText, offset);
-
-    _previous_text = text;
+    const int focus = (_focus_position < 0 ? -1 : qMax(0, _focus_position - (int) offset));
+    _document->enqueue(actualText, actualChange, offset, focus, _revision);
 }
 
-void MarkdownHighlighter::apply_format(unsigned long pos, unsigned long end,
-                                      QTextCharFormat format, bool merge)
+/**
+ * Turn overlapping ranges into disjoint ones, with the formats merged in the
+ * order of their styles like QTextLayout does for additional formats.
+ * setFormat() replaces formats instead of merging them.
+ */
+template <typename StyledRange>
+static QVector<QTextLayout::FormatRange> flatten_formats(QVector<StyledRange> ranges)
 {
-    // The QTextDocument contains an additional single paragraph separator (unicode 0x2029).
-    // https://bugreports.qt-project.org/browse/QTBUG-4841
-    unsigned long max_offset = document()->characterCount() - 1;
+    std::stable_sort(ranges.begin(), ranges.end(),
+                     [] (const StyledRange& a, const StyledRange& b) { return a.style < b.style; });
 
-    if (end <= pos || max_offset < pos)
-        return;
+    QVector<int> bounds;
+    bounds.reserve(ranges.size() * 2);
+    for (int i = 0; i < ranges.size(); ++i)
+    {
+        bounds.append(ranges.at(i).range.start);
+        bounds.append(ranges.at(i).range.start + ranges.at(i).range.length);
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
 
-    if (max_offset < end)
-        end = max_offset;
+    QVector<QTextLayout::FormatRange> flat;
+    for (int i = 0; i + 1 < bounds.size(); ++i)
+    {
+        QTextLayout::FormatRange segment;
+        segment.start = bounds.at(i);
+        segment.length = bounds.at(i + 1) - bounds.at(i);
 
-    // "The QTextLayout object can only be modified from the
-    // documentChanged implementation of a QAbstractTextDocumentLayout
-    // subclass. Any changes applied from the outside cause undefined
-    // behavior." -- we are breaking this rule here. There might be
-    // a better (more correct) way to do this.
+        bool covered = false;
+        for (int j = 0; j < ranges.size(); ++j)
+        {
+            const QTextLayout::FormatRange& r = ranges.at(j).range;
+            if (r.start <= segment.start && segment.start < r.start + r.length)
+            {
+                segment.format.merge(r.format);
+                covered = true;
+            }
+        }
+        if (!covered)
+            continue;
 
-    int startBlockNum = document()->findBlock(pos).blockNumber();
-    int endBlockNum = document()->findBlock(end).blockNumber();
-    for (int j = startBlockNum; j <= endBlockNum; j++)
-    {
-        QTextBlock block = document()->findBlockByNumber(j);
+        // join with the previous segment if the format is the same
+        if (!flat.isEmpty() && flat.last().start + flat.last().length == segment.start &&
+            flat.last().format == segment.format)
+            flat.last().length += segment.length;
+        else
+            flat.append(segment);
+    }
+    return flat;
+}
 
-        QTextLayout *layout = block.layout();
-        int blockpos = block.position();
-        QTextLayout::FormatRange r;
-        r.format = format;
-        QList<QTextLayout::FormatRange> list;
-        if (merge)
-            list = layout->additionalFormats();
+void MarkdownHighlighter::result_ready(const HighlightElements& elements, unsigned long base_offset,
+                                       long revision)
+{
+    // the text has changed since the snapshot, a newer result will follow
+    if (revision != _revision)
+        return;
+
+    // blocks of a partly applied result are unknown
+    if (!_applying_formats.isEmpty() && !_applying_window)
+        _applied_valid = false;
+
+    const TextChange change = _unapplied_change;
+    _unapplied_change = TextChange(0, 0, 0);
+    _applying_elements = elements;
+    _applying_offset = base_offset;
+    _applying_window = false;
+
+    _applying_formats.clear();
+    _applying_formats.resize(document()->blockCount());
+    _changed_first = 0;
+    _changed_last = _applying_formats.size() - 1;
+    if (_applied_valid && !change.is_full())
+    {
+        long begin = 0, end = 0;
+        bool changed = changed_range(_applied_elements, _applied_offset, elements, base_offset,
+                                     change, &begin, &end);
 
-        if (j == startBlockNum)
+        // blocks that got the formats of a window result differ from the
+        // last result applied in full
+        if (_window_begin >= 0)
         {
-            r.start = pos - blockpos;
-            r.length = (startBlockNum == endBlockNum) ? end - pos : block.length() - r.start;
+            begin = (changed ? qMin(begin, _window_begin) : _window_begin);
+            end = (changed ? qMax(end, _window_end) : _window_end);
+            changed = true;
         }
-        else if (j == endBlockNum)
+        if (!changed)
         {
-            r.start = 0;
-            r.length = end - blockpos;
+            _applied_elements = elements;
+            _applied_offset = base_offset;
+            _applying_formats.clear();
+            _applying_elements.clear();
+            return;
         }
-        else
+        _changed_first = document()->findBlock(begin).blockNumber();
+        _changed_last = document()->findBlock(end).blockNumber();
+        if (_changed_first < 0)
+            _changed_first = _applying_formats.size() - 1;
+        if (_changed_last < 0)
+            _changed_last = _applying_formats.size() - 1;
+    }
+    _window_begin = _window_end = -1;
+
+    collect_formats(elements, base_offset);
+    start_applying(revision);
+}
+
+void MarkdownHighlighter::window_ready(const HighlightElements& elements, unsigned long base_offset,
+                                       int begin, int end, long revision)
+{
+    if (revision != _revision)
+        return;
+
+    // Only the blocks inside the window are applied, the others keep their
+    // formats. The window starts at a block, but may end inside one.
+    const long window_begin = begin + base_offset, window_end = end + base_offset;
+    const QTextBlock first = document()->findBlock(window_begin);
+    const QTextBlock behind = document()->findBlock(window_end);
+    if (!first.isValid())
+        return;
+    _changed_first = first.blockNumber();
+    _changed_last = (window_end >= document()->characterCount() - 1 || !behind.isValid() ?
+                     document()->blockCount() - 1 : behind.blockNumber() - 1);
+    if (_changed_last < _changed_first)
+        return;
+
+    // blocks of a partly applied result are unknown
+    if (!_applying_formats.isEmpty() && !_applying_window)
+        _applied_valid = false;
+
+    _window_begin = (_window_begin < 0 ? window_begin : qMin(_window_begin, window_begin));
+    _window_end = qMax(_window_end, window_end);
+
+    _applying_elements.clear();
+    _applying_window = true;
+    _applying_formats.clear();
+    _applying_formats.resize(document()->blockCount());
+    collect_formats(elements, base_offset);
+    start_applying(revision);
+}
+
+/**
+ * Collect the formats of the blocks in [_changed_first, _changed_last] from
+ * 'elements' into _applying_formats
+ */
+void MarkdownHighlighter::collect_formats(const HighlightElements& elements,
+                                          unsigned long base_offset)
+{
+    // styles of each element type, in their order
+    QVector<QVector<int> > styles_by_type(pmh_NUM_LANG_TYPES);
+    for (int i = 0; i < _highlighting_styles.size(); i++)
+        styles_by_type[_highlighting_styles.at(i).type].append(i);
+
+    // The QTextDocument contains an additional single paragraph separator (unicode 0x2029).
+    // https://bugreports.qt-project.org/browse/QTBUG-4841
+    const unsigned long max_offset = document()->characterCount() - 1;
+
+    const QTextBlock first_changed = document()->findBlockByNumber(_changed_first);
+    const QTextBlock last_changed = document()->findBlockByNumber(_changed_last);
+    if (!first_changed.isValid() || !last_changed.isValid())
+        return;
+    const unsigned long changed_pos = first_changed.position();
+    const unsigned long changed_end = last_changed.position() + last_changed.length();
+
+    // Sweep the elements, sorted by position, and the changed blocks
+    // together, and collect the formats of each block. Elements starting in
+    // front of the changed blocks start at the first of them.
+    QTextBlock block = first_changed;
+    int block_number = _changed_first;
+    for (int i = 0; i < elements.size(); ++i)
+    {
+        // text the parser did not get to in time stays plain
+        const HighlightElement& elem = elements.at(i);
+        if (UNPARSED_ELEMENT == elem.type)
+            continue;
+        const QVector<int>& styles = styles_by_type.at(elem.type);
+        const unsigned long pos = elem.pos + base_offset;
+        const unsigned long end = qMin(elem.end + base_offset, max_offset);
+        if (styles.isEmpty() || end <= pos || end <= changed_pos)
+            continue;
+        if (pos >= changed_end)
+            break;
+
+        while (block.isValid() && (unsigned long) (block.position() + block.length()) <= pos)
         {
-            r.start = 0;
-            r.length = block.length();
+            block = block.next();
+            ++block_number;
         }
+        if (!block.isValid())
+            break;
 
-        list.append(r);
-        layout->setAdditionalFormats(list);
+        QString address = elem.address;
+        if (elem.type == pmh_AUTO_LINK_EMAIL && !address.startsWith("mailto:"))
+            address = "mailto:" + address;
+
+        for (int j = 0; j < styles.size(); ++j)
+        {
+            StyledRange styled;
+            styled.style = styles.at(j);
+            styled.range.format = _highlighting_styles.at(styled.style).format;
+            if (/*_makeLinksClickable
+                &&*/ (elem.type == pmh_LINK
+                    || elem.type == pmh_AUTO_LINK_URL
+                    || elem.type == pmh_AUTO_LINK_EMAIL
+                    || elem.type == pmh_REFERENCE)
+                && !elem.address.isNull())
+            {
+                styled.range.format.setAnchor(true);
+                styled.range.format.setAnchorHref(address);
+                styled.range.format.setToolTip(address);
+            }
+
+            // split the element at block boundaries
+            QTextBlock spanned = block;
+            for (int n = block_number; spanned.isValid() && (unsigned long) spanned.position() < end; ++n)
+            {
+                if (n > _changed_last)
+                    break;
+                const unsigned long block_pos = spanned.position();
+                const unsigned long start = qMax(pos, block_pos);
+                styled.range.start = start - block_pos;
+                styled.range.length = qMin(end, block_pos + spanned.length()) - start;
+                _applying_formats[n].append(styled);
+                spanned = spanned.next();
+            }
+        }
     }
 }
 
-void MarkdownHighlighter::result_ready(pmh_element **elements, unsigned long base_offset)
+void MarkdownHighlighter::start_applying(long revision)
+{
+    // changed blocks from the focus position on are applied first
+    _visible_first = 0;
+    _visible_last = -1;
+    if (_focus_position >= 0)
+    {
+        const int focus = document()->findBlock(_focus_position).blockNumber();
+        _visible_first = qMax(focus, _changed_first);
+        _visible_last = qMin(focus + VISIBLE_BLOCK_COUNT, _changed_last);
+    }
+    _applying_revision = revision;
+    _applying_pass = 0;
+    _applying_next = qMax(_visible_first, 0);
+
+    apply_slice();
+}
+
+void MarkdownHighlighter::apply_slice()
 {
-    if (!elements)
+    // abandon the result after an edit
+    if (_applying_revision != _revision)
     {
-        qDebug() << "elements is null";
+        _applying_formats.clear();
+        _applying_elements.clear();
+        if (!_applying_window)
+            _applied_valid = false;
         return;
     }
 
-    // clear any format before base_offset
-    if (base_offset > 0)
-        apply_format(0, base_offset - 1, QTextCharFormat(), false);
+    QElapsedTimer timer;
+    timer.start();
 
-    // apply highlight results
-    for (int i = 0; i < _highlighting_styles.size(); i++)
+    QTextBlock block = document()->findBlockByNumber(_applying_next);
+    while (_applying_pass < 2 && timer.elapsed() < APPLY_SLICE_MS)
     {
-        HighlightingStyle style = _highlighting_styles.at(i);
-        pmh_element *elem_cursor = elements[style.type];
-        while (elem_cursor != NULL)
+        // skip the visible blocks in the second pass
+        if (1 == _applying_pass && _visible_first <= _applying_next && _applying_next <= _visible_last)
         {
-            unsigned long pos = elem_cursor->pos + base_offset;
-            unsigned long end = elem_cursor->end + base_offset;
+            _applying_next = _visible_last + 1;
+            block = document()->findBlockByNumber(_applying_next);
+        }
 
-            QTextCharFormat format = style.format;
-            if (/*_makeLinksClickable
-                &&*/ (elem_cursor->type == pmh_LINK
-                    || elem_cursor->type == pmh_AUTO_LINK_URL
-                    || elem_cursor->type == pmh_AUTO_LINK_EMAIL
-                    || elem_cursor->type == pmh_REFERENCE)
-                && elem_cursor->address != NULL)
-            {
-                QString address(elem_cursor->address);
-                if (elem_cursor->type == pmh_AUTO_LINK_EMAIL && !address.startsWith("mailto:"))
-                    address = "mailto:" + address;
-                format.setAnchor(true);
-                format.setAnchorHref(address);
-                format.setToolTip(address);
-            }
-            apply_format(pos, end, format, true);
+        const int last = (0 == _applying_pass ? _visible_last : _changed_last);
+        if (_applying_next > last || !block.isValid())
+        {
+            ++_applying_pass;
+            _applying_next = _changed_first;
+            block = document()->findBlockByNumber(_applying_next);
+            continue;
+        }
 
-            elem_cursor = elem_cursor->next;
+        HighlightBlockData *data = static_cast<HighlightBlockData*>(block.userData());
+        if (NULL == data)
+        {
+            data = new HighlightBlockData;
+            block.setUserData(data);
         }
+        data->block_revision = block.revision();
+        data->formats = flatten_formats(_applying_formats.at(_applying_next));
+
+        // QSyntaxHighlighter relayouts the block only if its formats changed
+        _formatting = true;
+        rehighlightBlock(block);
+        _formatting = false;
+
+        block = block.next();
+        ++_applying_next;
     }
 
-    // mark complete document as dirty
-    document()->markContentsDirty(0, document()->characterCount());
+    if (_applying_pass < 2)
+    {
+        _apply_timer.start();
+        return;
+    }
 
-    // free highlighting elements
-    ::pmh_free_elements(elements);
+    _applying_formats.clear();
+    if (!_applying_window)
+    {
+        _applied_elements = _applying_elements;
+        _applied_offset = _applying_offset;
+        _applied_valid = true;
+    }
+    _applying_elements.clear();
 }
 
 }
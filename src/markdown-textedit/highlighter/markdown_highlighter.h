@@ -3,24 +3,83 @@
 #define ___HEADFILE_ABB9D205_6349_40DB_AB8A_29D2E8000DE6_
 
 #include <QSyntaxHighlighter>
+#include <QTextBlockUserData>
+#include <QTextLayout>
+#include <QTimer>
 
 #include <pmh_definitions.h>
 #include <pmh-adapter/definitions.h>
 
-#include "highlight_worker_thread.h"
+#include "highlight_document.h"
+#include "highlight_service.h"
 
 namespace mdtextedit
 {
 
+/**
+ * Formats of a block as computed from the last applied result; they are
+ * valid as long as the block keeps its revision
+ */
+class HighlightBlockData : public QTextBlockUserData
+{
+public:
+    int block_revision = -1;
+    QVector<QTextLayout::FormatRange> formats; // disjoint, sorted by start
+};
+
 class MarkdownHighlighter : public QSyntaxHighlighter
 {
     Q_OBJECT
 
 private:
-    HighlightWorkerThread *_worker_thread = NULL;
+    HighlightDocument *_document = NULL;
+    HighlightService *_own_service = NULL; // only in dedicated thread mode
     QVector<PegMarkdownHighlight::HighlightingStyle> _highlighting_styles;
-    QString _previous_text;
     bool _yaml_header_support_enabled = false;
+    int _focus_position = -1;
+
+    // Bumped on every edit of the document; a snapshot is handed to the
+    // worker thread only when the enqueued revision falls behind
+    long _revision = 0;
+    long _enqueued_revision = -1;
+
+    // Length of the plain text _document has, which it keeps up to date
+    // edit by edit rather than taking the whole document each time; -1 if it
+    // has to take it again
+    int _text_length = -1;
+
+    // Set while we mark formatted text dirty, which QTextDocument reports
+    // through contentsChange() as well
+    bool _formatting = false;
+
+    // A result is applied in time slices, the visible blocks first; a newer
+    // result or an edit abandons the rest of it
+    struct StyledRange
+    {
+        int style;                      // index in _highlighting_styles
+        QTextLayout::FormatRange range;
+    };
+    QVector<QVector<StyledRange> > _applying_formats; // by block number
+    long _applying_revision = -1;
+    int _visible_first = 0, _visible_last = -1; // block numbers
+    int _applying_pass = 0;                     // 0 inside the visible blocks, 1 outside
+    int _applying_next = 0;
+    QTimer _apply_timer;
+
+    // The last result applied in full. The next result is compared with it,
+    // and only blocks whose formatting changes, or which were edited in
+    // between, are applied again.
+    HighlightElements _applied_elements, _applying_elements;
+    unsigned long _applied_offset = 0, _applying_offset = 0;
+    bool _applied_valid = false;
+    TextChange _unapplied_change;               // edits since the last accepted result
+    int _changed_first = 0, _changed_last = -1; // block numbers
+
+    // A window result covers some blocks only, and is applied to those
+    // alone. Until the next result is applied, they differ from the last
+    // result applied in full; the range they span is mapped through edits.
+    bool _applying_window = false;
+    long _window_begin = -1, _window_end = -1;
 
 public:
     MarkdownHighlighter(QTextDocument *document);
@@ -32,14 +91,38 @@ public:
     void set_spelling_check_enabled(bool enabled);
     void set_yaml_header_support_enabled(bool enabled);
 
+    // Visible documents are highlighted before hidden ones
+    void set_visible(bool visible);
+
+    // Position of the first visible block. When the whole of a long document
+    // has to be parsed, the blocks around it are parsed first, and results
+    // are applied there first. -1 (the default) disables this.
+    void set_focus_position(int position);
+
+    // By default all highlighters share the threads of the global
+    // HighlightService. In dedicated thread mode, highlighters created
+    // afterwards get a thread of their own, as in former versions.
+    static void set_dedicated_thread_mode(bool enabled);
+    static bool dedicated_thread_mode();
+
+    // Current highlighting delay and the measurements it is based on
+    DebounceStats debounce_stats() const;
+
 protected:
     virtual void highlightBlock(const QString &textBlock) override;
 
 private slots:
-    void result_ready(pmh_element **elements, unsigned long base_offset);
+    void contents_changed(int position, int chars_removed, int chars_added);
+    void result_ready(const HighlightElements& elements, unsigned long base_offset, long revision);
+    void window_ready(const HighlightElements& elements, unsigned long base_offset,
+                      int begin, int end, long revision);
+    void apply_slice();
 
 private:
-    void apply_format(unsigned long pos, unsigned long end, QTextCharFormat format, bool merge);
+    void enqueue_edit(const TextChange& change);
+    void enqueue_snapshot(const QString& text, const TextChange& change);
+    void collect_formats(const HighlightElements& elements, unsigned long base_offset);
+    void start_applying(long revision);
     void check_spelling(const QString &textBlock);
 
 };
@@ -39,6 +39,7 @@ MarkdownTextEdit::MarkdownTextEdit(QWidget *parent)
 
     // setup the markdown highlighting
     _highlighter = new MarkdownHighlighter(document());
+    _highlighter->set_focus_position(0);
 
     // Set font
     QFont font("Monospace", 10);
@@ -383,6 +384,20 @@ void MarkdownTextEdit::resizeEvent(QResizeEvent *event)
         QRect(cr.left(), cr.top(), line_number_area_width(), cr.height())));
 }
 
+void MarkdownTextEdit::showEvent(QShowEvent *event)
+{
+    QPlainTextEdit::showEvent(event);
+
+    // editors on screen are highlighted first
+    _highlighter->set_visible(true);
+}
+
+void MarkdownTextEdit::hideEvent(QHideEvent *event)
+{
+    QPlainTextEdit::hideEvent(event);
+    _highlighter->set_visible(false);
+}
+
 void MarkdownTextEdit::draw_line_end_marker(QPaintEvent *e)
 {
     QPainter painter(viewport());
@@ -513,7 +528,12 @@ void MarkdownTextEdit::update_line_number_area_width(int new_block_count)
 void MarkdownTextEdit::update_line_number_area(const QRect &rect, int dy)
 {
     if (dy)
+    {
         _line_Number_area->scroll(0, dy);
+
+        // highlighting of long documents starts at the viewport
+        _highlighter->set_focus_position(firstVisibleBlock().position());
+    }
     else
         _line_Number_area->update(0, rect.y(), _line_Number_area->width(), rect.height());
 
@@ -937,6 +957,8 @@ void MarkdownTextEdit::duplicate_text()
 
 void MarkdownTextEdit::set_content(const QString & text)
 {
+    // the new text is shown from its beginning on
+    _highlighter->set_focus_position(0);
     QPlainTextEdit::setPlainText(text);
     adjust_right_margin();
 }
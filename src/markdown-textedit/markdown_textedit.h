@@ -97,6 +97,8 @@ protected:
     virtual void contextMenuEvent(QContextMenuEvent *e) override;
     virtual void paintEvent(QPaintEvent *e) override;
     virtual void resizeEvent(QResizeEvent *event) override;
+    virtual void showEvent(QShowEvent *event) override;
+    virtual void hideEvent(QHideEvent *event) override;
 
     bool increase_selected_text_indention(bool reverse);
     bool handle_tab_entered(bool reverse);
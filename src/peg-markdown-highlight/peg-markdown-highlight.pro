@@ -17,6 +17,7 @@ SOURCES += \
     pmh_styleparser.c
 
 HEADERS += \
+    pmh_parser_ext.h \
     $${SRC_ROOT}/pmh_styleparser.h \
     $${SRC_ROOT}/pmh_parser.h \
     $${SRC_ROOT}/pmh_definitions.h
@@ -27,6 +27,26 @@ struct _GREG;
  */
 
 #include "pmh_parser.h"
+#include "pmh_parser_ext.h"
+
+#include <stddef.h>
+#include <limits.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define pmh_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) \
+      || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define pmh_SIMD_SSE2
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <process.h>
+#else
+#include <time.h>
+#include <pthread.h>
+#endif
 
 #ifndef pmh_DEBUG_OUTPUT
 #define pmh_DEBUG_OUTPUT 0
@@ -44,16 +64,14 @@ struct _GREG;
 
 
 
-// Alias strdup to _strdup on MSVC:
-#ifdef _MSC_VER
-#define strdup _strdup
+// Memory for the GREG parser buffers and for the element arena comes from
+// these hooks, which the host may define to plug in its own allocator:
+#ifndef YY_ALLOC
+#define YY_ALLOC(N, D) malloc(N)
+#endif
+#ifndef YY_FREE
+#define YY_FREE free
 #endif
-
-
-char *strdup_or_null(char *s)
-{
-    return (s == NULL) ? NULL : strdup(s);
-}
 
 
 // Internal language element occurrence structure, containing
@@ -89,26 +107,201 @@ struct pmh_RealElement
 typedef struct pmh_RealElement pmh_realelement;
 
 
+// Number of input characters read between two polls of the cancellation
+// callback:
+#define pmh_CANCEL_POLL_INTERVAL 4096
+
+// Cancellation state, shared by all parser runs over one input:
+typedef struct
+{
+    pmh_cancel_callback callback;
+    void *context;
+    
+    /* Characters left to read until the next poll: */
+    int countdown;
+    
+    /* Whether the callback has asked us to stop: */
+    bool cancelled;
+} pmh_cancellation;
+
+// Number of parsing steps taken between two checks of the budget:
+#define pmh_BUDGET_CHECK_INTERVAL 1024
+
+// Budget of a parse, shared by all parser runs over one input. Every parse
+// has one, if only to poll the cancellation callback while backtracking:
+typedef struct
+{
+    /* Steps left until the next call of budget_left(): */
+    long countdown;
+    
+    /* Steps left in the budget besides those (ULONG_MAX if unlimited): */
+    unsigned long steps;
+    
+    /* When the time is up, by pmh_msecs() (0 if never): */
+    unsigned long long deadline;
+    
+    /* Whether the budget has run out or the parse was cancelled: */
+    bool exhausted;
+    
+    /* Length of the text, to which unparsed ranges are clipped: */
+    unsigned long text_len;
+    
+    /* Ranges left unparsed, in the arena of the result: */
+    pmh_range *unparsed;
+} pmh_budget;
+
+
+// Size of the first arena chunk; each further one doubles, up to the maximum:
+#define pmh_ARENA_CHUNK_SIZE        (16 * 1024)
+#define pmh_ARENA_CHUNK_SIZE_MAX    (1024 * 1024)
+#define pmh_ARENA_ALIGNMENT         8
+
+typedef struct pmh_ArenaChunk
+{
+    struct pmh_ArenaChunk *next;
+    size_t size;
+    size_t used;
+} pmh_arena_chunk;
+
+// Bump allocator holding all elements and strings of one parse. Nothing is
+// freed on its own; the whole arena goes away with the result:
+typedef struct
+{
+    pmh_arena_chunk *chunks; /* the one allocated from first */
+    size_t next_size;
+} pmh_arena;
+
+// The array of result lists handed out by the parser lives behind the
+// arena, so that pmh_free_elements() can find it:
+typedef struct
+{
+    pmh_arena arena;
+    pmh_realelement *head_elems[pmh_NUM_TYPES];
+} pmh_result;
+
+#define pmh_ARENA_CHUNK_HEADER_SIZE \
+    ((sizeof(pmh_arena_chunk) + pmh_ARENA_ALIGNMENT - 1) \
+     & ~(size_t)(pmh_ARENA_ALIGNMENT - 1))
+
+static void *arena_alloc(pmh_arena *arena, size_t size, void *alloc_data)
+{
+    (void)alloc_data; // unused by the default YY_ALLOC
+    size = (size + pmh_ARENA_ALIGNMENT - 1) & ~(size_t)(pmh_ARENA_ALIGNMENT - 1);
+    
+    pmh_arena_chunk *chunk = arena->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < size)
+    {
+        size_t chunk_size = arena->next_size;
+        if (chunk_size < size)
+            chunk_size = size;
+        chunk = (pmh_arena_chunk *)YY_ALLOC(pmh_ARENA_CHUNK_HEADER_SIZE
+                                            + chunk_size, alloc_data);
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        if (arena->next_size < pmh_ARENA_CHUNK_SIZE_MAX)
+            arena->next_size *= 2;
+    }
+    
+    void *ret = (char *)chunk + pmh_ARENA_CHUNK_HEADER_SIZE + chunk->used;
+    chunk->used += size;
+    return ret;
+}
+
+static void arena_free(pmh_arena *arena)
+{
+    pmh_arena_chunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        pmh_arena_chunk *tofree = chunk;
+        chunk = chunk->next;
+        YY_FREE(tofree);
+    }
+    arena->chunks = NULL;
+}
+
+
+// Reference definitions by label, see get_reference():
+typedef struct pmh_ReferenceEntry
+{
+    struct pmh_ReferenceEntry *next;
+    unsigned long hash;
+    pmh_realelement *reference;
+} pmh_reference_entry;
+
+typedef struct
+{
+    pmh_reference_entry **buckets;
+    size_t num_buckets; /* a power of two */
+} pmh_reference_table;
+
+
+// Entry of the index over the spans to parse, see fix_offsets():
+typedef struct
+{
+    pmh_realelement *span;
+    
+    /* Range of the span in the parsed text: */
+    unsigned long parsed_pos;
+    unsigned long parsed_end;
+    
+    /* End of the last pmh_RAW span in front of this one (0 if none): */
+    unsigned long previous_end;
+} pmh_span_index_entry;
+
+
+// Storage of a variable for each thread:
+#ifdef _MSC_VER
+#define pmh_THREAD_LOCAL __declspec(thread)
+#else
+#define pmh_THREAD_LOCAL __thread
+#endif
+
+// Parser context, reused by all parser runs of a thread (see
+// acquire_context()):
+typedef struct
+{
+    /* The greg state, whose buffers are kept between runs: */
+    struct _GREG *G;
+    
+    /* The memo of pmh_EXT_MEMOIZE, once a run has used one: */
+    struct pmh_Memo *memo;
+    
+    /* Whether a parse is using the context: */
+    bool in_use;
+} pmh_parse_context;
 
 
 // Parser state data:
 typedef struct
 {
-    /* The original, unmodified UTF-8 input: */
-    char *original_input;
+    /* The original, unmodified input: UTF-8 at original_input, or UTF-16 */
+    /* at original_utf16 (the other one is NULL): */
+    const char *original_input;
+    const unsigned short *original_utf16;
     
-    /* The offsets of the bytes we have stripped from original_input: */
+    /* The offsets of the bytes (or UTF-16 code units) we have stripped */
+    /* from the original input: */
     unsigned long *strip_positions;
     size_t strip_positions_len;
     
-    /* Buffer of characters to be parsed: */
-    char *charbuf;
+    /* Buffer of characters to be parsed, and their number (without the */
+    /* "\n\n" suffix, which is not in it): */
+    const char *charbuf;
+    unsigned long charbuf_len;
     
     /* Linked list of {start, end} offset pairs determining which parts */
     /* of charbuf to actually parse: */
     pmh_realelement *current_elem;
     pmh_realelement *elem_head;
     
+    /* Index over the spans of elem_head, built when first needed, and */
+    /* the number of entries allocated for it: */
+    pmh_span_index_entry *span_index;
+    size_t span_index_len;
+    size_t span_index_size;
+    bool span_index_built;
+    
     /* Current parsing offset within charbuf: */
     unsigned long offset;
     
@@ -124,95 +317,214 @@ typedef struct
     
     /* List of reference elements: */
     pmh_realelement *references;
+    
+    /* The same references by label (NULL until they are known): */
+    pmh_reference_table *reference_table;
+    
+    /* Cancellation state (NULL if not cancellable): */
+    pmh_cancellation *cancellation;
+    
+    /* Budget state (never NULL while parsing): */
+    pmh_budget *budget;
+    
+    /* Whether out_of_budget() has stopped the input, and its real limit: */
+    bool input_stopped;
+    int stopped_limit;
+    
+    /* Where elements and their strings are allocated: */
+    pmh_arena *arena;
+    
+    /* Results of rules, if pmh_EXT_MEMOIZE is set (see memoized()): */
+    struct pmh_Memo *memo;
+    
+    /* Where the parser runs over the input (shared by all of them): */
+    pmh_parse_context *context;
+    
+    /* How many times the input has reported its end: */
+    unsigned long input_ends;
 } parser_data;
 
-static parser_data *mk_parser_data(char *original_input,
+/* Have the next parser run of `p_data` parse the spans `parsing_elems` */
+static void set_parsing_elems(parser_data *p_data,
+                              pmh_realelement *parsing_elems,
+                              unsigned long offset)
+{
+    p_data->offset = offset;
+    p_data->elem_head = p_data->current_elem = parsing_elems;
+    p_data->span_index_len = 0;
+    p_data->span_index_built = false;
+}
+
+static parser_data *mk_parser_data(const char *original_input,
+                                   const unsigned short *original_utf16,
                                    unsigned long *strip_positions,
                                    size_t strip_positions_len,
-                                   char *charbuf,
+                                   const char *charbuf,
+                                   unsigned long charbuf_len,
                                    pmh_realelement *parsing_elems,
                                    unsigned long offset,
                                    int extensions,
                                    pmh_realelement **head_elems,
+                                   pmh_arena *arena,
                                    pmh_realelement *references)
 {
     parser_data *p_data = (parser_data *)malloc(sizeof(parser_data));
     p_data->extensions = extensions;
     p_data->original_input = original_input;
+    p_data->original_utf16 = original_utf16;
     p_data->strip_positions = strip_positions;
     p_data->strip_positions_len = strip_positions_len;
     p_data->charbuf = charbuf;
-    p_data->offset = offset;
-    p_data->elem_head = p_data->current_elem = parsing_elems;
+    p_data->charbuf_len = charbuf_len;
+    p_data->span_index = NULL;
+    p_data->span_index_size = 0;
+    set_parsing_elems(p_data, parsing_elems, offset);
     p_data->references = references;
+    p_data->reference_table = NULL;
     p_data->parsing_only_references = false;
-    if (head_elems != NULL)
+    p_data->memo = NULL;
+    p_data->context = NULL;
+    p_data->input_ends = 0;
+    p_data->cancellation = NULL;
+    p_data->budget = NULL;
+    p_data->input_stopped = false;
+    p_data->stopped_limit = 0;
+    if (head_elems != NULL) {
         p_data->head_elems = head_elems;
-    else {
-        p_data->head_elems = (pmh_realelement **)
-                             malloc(sizeof(pmh_realelement *) * pmh_NUM_TYPES);
+        p_data->arena = arena;
+    } else {
+        pmh_result *result = (pmh_result *)malloc(sizeof(pmh_result));
+        result->arena.chunks = NULL;
+        result->arena.next_size = pmh_ARENA_CHUNK_SIZE;
         int i;
         for (i = 0; i < pmh_NUM_TYPES; i++)
-            p_data->head_elems[i] = NULL;
+            result->head_elems[i] = NULL;
+        p_data->head_elems = result->head_elems;
+        p_data->arena = &result->arena;
     }
     return p_data;
 }
 
+static void free_parser_data(parser_data *p_data)
+{
+    free(p_data->span_index);
+    free(p_data);
+}
 
-// Forward declarations
-static void parse_markdown(parser_data *p_data);
-static void parse_references(parser_data *p_data);
-
-
-
-
+/* Poll the cancellation callback; once cancelled, stay cancelled */
+static bool is_cancelled(parser_data *p_data, bool poll_now)
+{
+    pmh_cancellation *c = p_data->cancellation;
+    if (c == NULL || c->cancelled)
+        return (c != NULL);
+    if (!poll_now && --c->countdown > 0)
+        return false;
+    c->countdown = pmh_CANCEL_POLL_INTERVAL;
+    c->cancelled = c->callback(c->context);
+    return c->cancelled;
+}
+
+/* Milliseconds on a monotonic clock */
+static unsigned long long pmh_msecs(void)
+{
+#ifdef _WIN32
+    return GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
 
-static char **get_element_type_names()
+/*
+Called by take_step() when the countdown of the budget has run out: hand
+out the next steps, unless the budget is exhausted or the parse was
+cancelled.
+*/
+static bool budget_left(parser_data *p_data)
 {
-    static char **elem_type_names = NULL;
-    if (elem_type_names == NULL)
+    pmh_budget *b = p_data->budget;
+    b->countdown = 0;
+    if (b->exhausted)
+        return false;
+    if (is_cancelled(p_data, true) || b->steps == 0
+        || (b->deadline != 0 && pmh_msecs() >= b->deadline))
     {
-        elem_type_names = (char **)malloc(sizeof(char*) * pmh_NUM_LANG_TYPES);
-        int i;
-        for (i = 0; i < pmh_NUM_LANG_TYPES; i++)
-            elem_type_names[i] = NULL;
-        elem_type_names[pmh_LINK] = "LINK";
-        elem_type_names[pmh_AUTO_LINK_URL] = "AUTO_LINK_URL";
-        elem_type_names[pmh_AUTO_LINK_EMAIL] = "AUTO_LINK_EMAIL";
-        elem_type_names[pmh_IMAGE] = "IMAGE";
-        elem_type_names[pmh_CODE] = "CODE";
-        elem_type_names[pmh_HTML] = "HTML";
-        elem_type_names[pmh_HTML_ENTITY] = "HTML_ENTITY";
-        elem_type_names[pmh_EMPH] = "EMPH";
-        elem_type_names[pmh_STRONG] = "STRONG";
-        elem_type_names[pmh_LIST_BULLET] = "LIST_BULLET";
-        elem_type_names[pmh_LIST_ENUMERATOR] = "LIST_ENUMERATOR";
-        elem_type_names[pmh_COMMENT] = "COMMENT";
-        elem_type_names[pmh_H1] = "H1";
-        elem_type_names[pmh_H2] = "H2";
-        elem_type_names[pmh_H3] = "H3";
-        elem_type_names[pmh_H4] = "H4";
-        elem_type_names[pmh_H5] = "H5";
-        elem_type_names[pmh_H6] = "H6";
-        elem_type_names[pmh_BLOCKQUOTE] = "BLOCKQUOTE";
-        elem_type_names[pmh_VERBATIM] = "VERBATIM";
-        elem_type_names[pmh_HTMLBLOCK] = "HTMLBLOCK";
-        elem_type_names[pmh_HRULE] = "HRULE";
-        elem_type_names[pmh_REFERENCE] = "REFERENCE";
-        elem_type_names[pmh_NOTE] = "NOTE";
-        elem_type_names[pmh_STRIKE] = "STRIKE";
+        b->exhausted = true;
+        return false;
     }
-    return elem_type_names;
+    
+    unsigned long steps = pmh_BUDGET_CHECK_INTERVAL;
+    if (b->steps != ULONG_MAX) {
+        if (steps > b->steps)
+            steps = b->steps;
+        b->steps -= steps;
+    }
+    b->countdown = (long)steps - 1; /* one is taken now */
+    return true;
+}
+
+/*
+Count a step of the parse: an attempt at a block, or at one of the inline
+rules that unclosed markers make the parser try again and again (see
+memoized()). Other rules are not counted; they only follow the text, and
+would cost a counter per character. Returns false once the budget is
+exhausted, see out_of_budget().
+*/
+static bool take_step(parser_data *p_data)
+{
+    return --p_data->budget->countdown >= 0 || budget_left(p_data);
 }
 
+
+// Forward declarations
+static void parse_markdown(parser_data *p_data);
+static void parse_references(parser_data *p_data);
+static pmh_parse_context *acquire_context(unsigned long text_len);
+static void release_context(pmh_parse_context *context);
+static void add_unparsed(parser_data *p_data, unsigned long pos, unsigned long end);
+static void add_unparsed_spans(parser_data *p_data, pmh_realelement *spans);
+
+
+
+
+
+// Names of the element types, as used in styles (NULL for types without
+// one). The table is constant, so any number of threads may read it:
+static const char *const element_type_names[pmh_NUM_LANG_TYPES] = {
+    [pmh_LINK] = "LINK",
+    [pmh_AUTO_LINK_URL] = "AUTO_LINK_URL",
+    [pmh_AUTO_LINK_EMAIL] = "AUTO_LINK_EMAIL",
+    [pmh_IMAGE] = "IMAGE",
+    [pmh_CODE] = "CODE",
+    [pmh_HTML] = "HTML",
+    [pmh_HTML_ENTITY] = "HTML_ENTITY",
+    [pmh_EMPH] = "EMPH",
+    [pmh_STRONG] = "STRONG",
+    [pmh_LIST_BULLET] = "LIST_BULLET",
+    [pmh_LIST_ENUMERATOR] = "LIST_ENUMERATOR",
+    [pmh_COMMENT] = "COMMENT",
+    [pmh_H1] = "H1",
+    [pmh_H2] = "H2",
+    [pmh_H3] = "H3",
+    [pmh_H4] = "H4",
+    [pmh_H5] = "H5",
+    [pmh_H6] = "H6",
+    [pmh_BLOCKQUOTE] = "BLOCKQUOTE",
+    [pmh_VERBATIM] = "VERBATIM",
+    [pmh_HTMLBLOCK] = "HTMLBLOCK",
+    [pmh_HRULE] = "HRULE",
+    [pmh_REFERENCE] = "REFERENCE",
+    [pmh_NOTE] = "NOTE",
+    [pmh_STRIKE] = "STRIKE",
+};
+
 pmh_element_type pmh_element_type_from_name(char *name)
 {
-    char **elem_type_names = get_element_type_names();
-    
     int i;
     for (i = 0; i < pmh_NUM_LANG_TYPES; i++)
     {
-        char *i_name = elem_type_names[i];
+        const char *i_name = element_type_names[i];
         if (i_name == NULL)
             continue;
         if (strcmp(i_name, name) == 0)
@@ -224,11 +536,11 @@ pmh_element_type pmh_element_type_from_name(char *name)
 
 char *pmh_element_name_from_type(pmh_element_type type)
 {
-    char **elem_type_names = get_element_type_names();
-    char* ret = elem_type_names[type];
-    if (ret == NULL)
+    // The internal types, past the language ones, have no names either
+    if ((int)type < 0 || type >= pmh_NUM_LANG_TYPES
+        || element_type_names[type] == NULL)
         return "unknown type";
-    return ret;
+    return (char *)element_type_names[type];
 }
 
 
@@ -312,6 +624,27 @@ iteratively until no such elements exist.
 static void process_raw_blocks(parser_data *p_data)
 {
     pmh_PRINTF("--------process_raw_blocks---------\n");
+    
+    // The runs share one parser_data, which keeps its span index:
+    parser_data *raw_p_data = mk_parser_data(
+        p_data->original_input,
+        p_data->original_utf16,
+        p_data->strip_positions,
+        p_data->strip_positions_len,
+        p_data->charbuf,
+        p_data->charbuf_len,
+        NULL,
+        0,
+        p_data->extensions,
+        p_data->head_elems,
+        p_data->arena,
+        p_data->references
+    );
+    raw_p_data->cancellation = p_data->cancellation;
+    raw_p_data->budget = p_data->budget;
+    raw_p_data->context = p_data->context;
+    raw_p_data->reference_table = p_data->reference_table;
+    
     while (p_data->head_elems[pmh_RAW_LIST] != NULL)
     {
         pmh_PRINTF("new iteration.\n");
@@ -319,6 +652,11 @@ static void process_raw_blocks(parser_data *p_data)
         p_data->head_elems[pmh_RAW_LIST] = NULL;
         while (cursor != NULL)
         {
+            if (is_cancelled(p_data, true)) {
+                free_parser_data(raw_p_data);
+                return;
+            }
+            
             pmh_realelement *span_list = (pmh_realelement*)cursor->children;
             
             span_list = remove_zero_length_raw_spans(span_list);
@@ -359,20 +697,15 @@ static void process_raw_blocks(parser_data *p_data)
                 pmh_PRINTF("\n");
                 #endif
                 
+                // Out of budget, the rest stays unparsed:
+                if (p_data->budget->exhausted) {
+                    add_unparsed_spans(p_data, subspan_list);
+                    continue;
+                }
+                
                 // Process subspan_list:
-                parser_data *raw_p_data = mk_parser_data(
-                    p_data->original_input,
-                    p_data->strip_positions,
-                    p_data->strip_positions_len,
-                    p_data->charbuf,
-                    subspan_list,
-                    subspan_list->pos,
-                    p_data->extensions,
-                    p_data->head_elems,
-                    p_data->references
-                );
+                set_parsing_elems(raw_p_data, subspan_list, subspan_list->pos);
                 parse_markdown(raw_p_data);
-                free(raw_p_data);
                 
                 pmh_PRINTF("parse over\n");
             }
@@ -380,119 +713,1129 @@ static void process_raw_blocks(parser_data *p_data)
             cursor = cursor->next;
         }
     }
+    
+    free_parser_data(raw_p_data);
+}
+
+
+#if pmh_DEBUG_OUTPUT
+static void print_raw_blocks(const char *text, pmh_realelement *elem[])
+{
+    pmh_PRINTF("--------print_raw_blocks---------\n");
+    pmh_PRINTF("block:\n");
+    pmh_realelement *cursor = elem[pmh_RAW_LIST];
+    while (cursor != NULL)
+    {
+        print_raw_spans_inline(cursor->children);
+        cursor = cursor->next;
+    }
+}
+#endif
+
+
+
+
+/* Free all elements created while parsing */
+void pmh_free_elements(pmh_element **elems)
+{
+    pmh_result *result = (pmh_result *)((char *)elems
+                                        - offsetof(pmh_result, head_elems));
+    arena_free(&result->arena);
+    free(result);
+}
+
+
+
+
+
+
+#define IS_CONTINUATION_BYTE(x) ((x & 0xC0) == 0x80)
+#define HAS_UTF8_BOM(x, len)    ( (len) >= 3 \
+                                  && ((*x & 0xFF) == 0xEF)\
+                                  && ((*(x+1) & 0xFF) == 0xBB)\
+                                  && ((*(x+2) & 0xFF) == 0xBF) )
+#define ADD_STRIP_POS(x) \
+    /* reallocate more space for the array, if needed: */ \
+    if (strip_positions_size <= strip_positions_pos) { \
+        strip_positions_size = (strip_positions_size == 0) \
+                               ? 1024 : strip_positions_size * 2; \
+        strip_positions = (unsigned long *) \
+                          realloc(strip_positions, \
+                                  sizeof(unsigned long) \
+                                  * strip_positions_size); \
+    } \
+    strip_positions[strip_positions_pos] = x; \
+    strip_positions_pos++;
+
+// Test of a block of pmh_BLOCK_SIZE bytes of the input at once, for
+// preformat(): whether it has bytes outside of ASCII:
+#if defined(pmh_SIMD_AVX2)
+#define pmh_BLOCK_SIZE 32
+
+static bool block_has_high_bits(const char *block)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i *)block);
+    return (_mm256_movemask_epi8(v) != 0);
+}
+#elif defined(pmh_SIMD_SSE2)
+#define pmh_BLOCK_SIZE 16
+
+static bool block_has_high_bits(const char *block)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)block);
+    return (_mm_movemask_epi8(v) != 0);
+}
+#else
+#define pmh_BLOCK_SIZE 8
+#define pmh_HIGH_BITS 0x8080808080808080ULL
+
+static bool block_has_high_bits(const char *block)
+{
+    unsigned long long w;
+    memcpy(&w, block, sizeof(w));
+    return ((w & pmh_HIGH_BITS) != 0);
+}
+#endif
+
+// What preformat() puts in place of a byte that is not part of valid UTF-8,
+// and preformat_utf16() in place of a code unit outside of ASCII: like the
+// first byte of a UTF-8 sequence would, it reads as a text character to the
+// grammar, which tells no two such characters apart
+#define pmh_NON_ASCII_CHAR  ((char)0x80)
+
+/* The length of the valid UTF-8 sequence at `str`, with `len` bytes left
+   (RFC 3629: no overlong forms, surrogates or code points past U+10FFFF),
+   or 0 if there is none */
+static int utf8_sequence_length(const unsigned char *str, unsigned long len)
+{
+    unsigned char lead = str[0];
+    int n;
+    unsigned char lo = 0x80, hi = 0xBF; // range of the second byte
+    if (lead >= 0xC2 && lead <= 0xDF)
+        n = 2;
+    else if (lead >= 0xE0 && lead <= 0xEF) {
+        n = 3;
+        if (lead == 0xE0)
+            lo = 0xA0;
+        else if (lead == 0xED)
+            hi = 0x9F;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        n = 4;
+        if (lead == 0xF0)
+            lo = 0x90;
+        else if (lead == 0xF4)
+            hi = 0x8F;
+    } else {
+        return 0;
+    }
+    
+    if ((unsigned long)n > len || str[1] < lo || str[1] > hi)
+        return 0;
+    int k;
+    for (k = 2; k < n; k++) {
+        if (!IS_CONTINUATION_BYTE(str[k]))
+            return 0;
+    }
+    return n;
+}
+
+/*
+Prepare the `len` bytes of UTF-8 at `str` for parsing. The parser reads
+one character for every code point, so the UTF-8 continuation bytes are
+removed, as is a BOM (byte order mark), and the offsets of the removed
+bytes are stored in `*out_strip_positions`. If the input is pure ASCII, it
+is parsed as it is: `*out_copy` is set to NULL, and there are no strip
+positions. Otherwise it is set to a copy of the input without them,
+NUL-terminated. Return the number of characters to parse, not counting the
+"\n\n" suffix that the parser reads after them (like peg-markdown does, see
+yyrefill()).
+
+Each byte that is not part of a valid sequence becomes a character of its
+own, pmh_NON_ASCII_CHAR, as it becomes U+FFFD of its own when decoded by
+Qt: offsets stay those of the decoded text, and no stray byte reads as the
+start of a character outside of the BMP (see astral_offsets()).
+
+This takes one pass over the input, a block of bytes at a time (with SSE2
+or AVX2 if the compiler targets them), which copies ASCII blocks whole and
+checks the sequences in the others one by one.
+*/
+static unsigned long preformat(const char *str, unsigned long len,
+                               char **out_copy,
+                               unsigned long **out_strip_positions,
+                               size_t *out_strip_positions_len)
+{
+    // The ASCII in front needs nothing:
+    unsigned long i = 0;
+    while (i + pmh_BLOCK_SIZE <= len && !block_has_high_bits(str + i))
+        i += pmh_BLOCK_SIZE;
+    while (i < len && (str[i] & 0x80) == 0)
+        i++;
+    
+    *out_strip_positions = NULL;
+    *out_strip_positions_len = 0;
+    if (i == len) {
+        *out_copy = NULL;
+        return len;
+    }
+    
+    size_t strip_positions_size = 0;
+    size_t strip_positions_pos = 0;
+    unsigned long *strip_positions = NULL;
+    
+    char *copy = (char *)malloc(len + 1);
+    memcpy(copy, str, i);
+    unsigned long copy_len = i;
+    
+    if (i == 0 && HAS_UTF8_BOM(str, len)) {
+        ADD_STRIP_POS(0);
+        ADD_STRIP_POS(1);
+        ADD_STRIP_POS(2);
+        i = 3;
+    }
+    
+    while (i < len)
+    {
+        if (i + pmh_BLOCK_SIZE <= len && !block_has_high_bits(str + i)) {
+            memcpy(copy + copy_len, str + i, pmh_BLOCK_SIZE);
+            copy_len += pmh_BLOCK_SIZE;
+            i += pmh_BLOCK_SIZE;
+            continue;
+        }
+        
+        // Sequences may run past the block
+        unsigned long block_end = i + pmh_BLOCK_SIZE;
+        if (block_end > len)
+            block_end = len;
+        while (i < block_end)
+        {
+            if ((str[i] & 0x80) == 0) {
+                copy[copy_len++] = str[i++];
+                continue;
+            }
+            int n = utf8_sequence_length((const unsigned char *)str + i,
+                                         len - i);
+            if (n == 0) {
+                copy[copy_len++] = pmh_NON_ASCII_CHAR;
+                i++;
+                continue;
+            }
+            copy[copy_len++] = str[i];
+            int k;
+            for (k = 1; k < n; k++) {
+                ADD_STRIP_POS(i + k);
+            }
+            i += n;
+        }
+    }
+    copy[copy_len] = '\0';
+    
+    *out_copy = copy;
+    *out_strip_positions = strip_positions;
+    *out_strip_positions_len = strip_positions_pos;
+    return copy_len;
+}
+
+// Narrowing of a block of pmh_UNIT_BLOCK_SIZE UTF-16 code units at once,
+// for preformat_utf16(): if all of them are ASCII, write them to `out` as
+// bytes and return true, else leave `out` alone and return false:
+#if defined(pmh_SIMD_AVX2)
+#define pmh_UNIT_BLOCK_SIZE 32
+
+static bool narrow_ascii_units(const unsigned short *block, char *out)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i *)block);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(block + 16));
+    __m256i high = _mm256_and_si256(_mm256_or_si256(a, b),
+                                    _mm256_set1_epi16((short)0xFF80));
+    if (!_mm256_testz_si256(high, high))
+        return false;
+    // The pack works within 128-bit lanes; put the lanes back in order:
+    _mm256_storeu_si256((__m256i *)out,
+                        _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b),
+                                                 0xD8));
+    return true;
+}
+#elif defined(pmh_SIMD_SSE2)
+#define pmh_UNIT_BLOCK_SIZE 16
+
+static bool narrow_ascii_units(const unsigned short *block, char *out)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *)block);
+    __m128i b = _mm_loadu_si128((const __m128i *)(block + 8));
+    __m128i high = _mm_and_si128(_mm_or_si128(a, b),
+                                 _mm_set1_epi16((short)0xFF80));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(high, _mm_setzero_si128())) != 0xFFFF)
+        return false;
+    _mm_storeu_si128((__m128i *)out, _mm_packus_epi16(a, b));
+    return true;
+}
+#else
+#define pmh_UNIT_BLOCK_SIZE 4
+
+static bool narrow_ascii_units(const unsigned short *block, char *out)
+{
+    unsigned long long w;
+    memcpy(&w, block, sizeof(w));
+    if ((w & 0xFF80FF80FF80FF80ULL) != 0)
+        return false;
+    int i;
+    for (i = 0; i < pmh_UNIT_BLOCK_SIZE; i++)
+        out[i] = (char)block[i];
+    return true;
+}
+#endif
+
+/*
+Prepare the `len` UTF-16 code units at `str` for parsing, like preformat()
+does UTF-8, into a copy with one character for every code unit, so that
+offsets into it count code units (those of a surrogate pair included). The
+ASCII units become their bytes, and all others pmh_NON_ASCII_CHAR. A BOM is
+removed, its offset stored in `*out_strip_positions`, and a NUL ends the
+text. Return the number of characters to parse.
+*/
+static unsigned long preformat_utf16(const unsigned short *str,
+                                     unsigned long len,
+                                     char **out_copy,
+                                     unsigned long **out_strip_positions,
+                                     size_t *out_strip_positions_len)
+{
+    unsigned long i = 0;
+    *out_strip_positions = NULL;
+    *out_strip_positions_len = 0;
+    if (len > 0 && str[0] == 0xFEFF) {
+        *out_strip_positions = (unsigned long *)malloc(sizeof(unsigned long));
+        (*out_strip_positions)[0] = 0;
+        *out_strip_positions_len = 1;
+        i = 1;
+    }
+    
+    char *copy = (char *)malloc(len - i + 1);
+    unsigned long copy_len = 0;
+    while (i < len)
+    {
+        if (i + pmh_UNIT_BLOCK_SIZE <= len
+            && narrow_ascii_units(str + i, copy + copy_len))
+        {
+            copy_len += pmh_UNIT_BLOCK_SIZE;
+            i += pmh_UNIT_BLOCK_SIZE;
+            continue;
+        }
+        
+        unsigned long block_end = i + pmh_UNIT_BLOCK_SIZE;
+        if (block_end > len)
+            block_end = len;
+        for (; i < block_end; i++)
+            copy[copy_len++] = (str[i] < 0x80) ? (char)str[i]
+                                               : pmh_NON_ASCII_CHAR;
+    }
+    
+    const char *nul = (const char *)memchr(copy, '\0', copy_len);
+    if (nul != NULL)
+        copy_len = nul - copy;
+    copy[copy_len] = '\0';
+    
+    *out_copy = copy;
+    return copy_len;
+}
+
+/*
+Return the offsets, ascending, of the characters outside of the BMP among
+the `len` at `charbuf`, made of UTF-8 by preformat(): those whose first
+byte is 0xF0 or more, four bytes long in UTF-8 and two code units in
+UTF-16. Their number goes to `*out_len`.
+*/
+static unsigned long *astral_offsets(const char *charbuf, unsigned long len,
+                                     size_t *out_len)
+{
+    size_t size = 0, count = 0;
+    unsigned long *offsets = NULL;
+    unsigned long i = 0;
+    while (i < len)
+    {
+        if (i + pmh_BLOCK_SIZE <= len && !block_has_high_bits(charbuf + i)) {
+            i += pmh_BLOCK_SIZE;
+            continue;
+        }
+        
+        unsigned long block_end = i + pmh_BLOCK_SIZE;
+        if (block_end > len)
+            block_end = len;
+        for (; i < block_end; i++)
+        {
+            if ((unsigned char)charbuf[i] < 0xF0)
+                continue;
+            if (size <= count) {
+                size = (size == 0) ? 256 : size * 2;
+                offsets = (unsigned long *)realloc(offsets, sizeof(unsigned long)
+                                                            * size);
+            }
+            offsets[count++] = i;
+        }
+    }
+    *out_len = count;
+    return offsets;
+}
+
+/* Map `offset` in a charbuf to UTF-16 code units: every character outside
+   of the BMP in front of it (at `astral`, see astral_offsets()) moves it by
+   one, and a binary search finds their number. */
+static unsigned long utf16_offset(const unsigned long *astral,
+                                  size_t astral_len, unsigned long offset)
+{
+    size_t lo = 0, hi = astral_len;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (astral[mid] < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return offset + lo;
+}
+
+/* Move the elements of `result` and the `unparsed` ranges, parsed from the
+   `len` characters at `charbuf`, to offsets in UTF-16 code units (see
+   pmh_EXT_UTF16_OFFSETS) */
+static void offsets_to_utf16(const char *charbuf, unsigned long len,
+                             pmh_element **result, pmh_range *unparsed)
+{
+    size_t astral_len = 0;
+    unsigned long *astral = astral_offsets(charbuf, len, &astral_len);
+    if (astral_len > 0)
+    {
+        pmh_realelement *e;
+        for (e = ((pmh_realelement **)result)[pmh_ALL]; e != NULL;
+             e = e->all_elems_next)
+        {
+            e->pos = utf16_offset(astral, astral_len, e->pos);
+            e->end = utf16_offset(astral, astral_len, e->end);
+        }
+        pmh_range *r;
+        for (r = unparsed; r != NULL; r = r->next)
+        {
+            r->pos = utf16_offset(astral, astral_len, r->pos);
+            r->end = utf16_offset(astral, astral_len, r->end);
+        }
+    }
+    free(astral);
+}
+
+
+/*
+Parallel parsing. The reference pass runs over the whole text as usual;
+then the text is cut into chunks, which are parsed on several threads into
+results of their own, merged into one at the end. A chunk starts at a line
+that follows a blank line and starts a new top-level block, and only where
+no block or inline construct that has begun in front of it could reach
+past: see find_chunks(). Every chunk thus parses into the same elements as
+the same text did in the whole.
+*/
+
+// Least number of characters in a chunk, and the number of chunks to aim
+// for per thread, so that threads done early find more to do:
+#ifndef pmh_CHUNK_SIZE_MIN
+#define pmh_CHUNK_SIZE_MIN      (64 * 1024)
+#endif
+#define pmh_CHUNKS_PER_THREAD   4
+
+#define IS_ASCII_ALNUM(c)   (((c) >= 'a' && (c) <= 'z') \
+                             || ((c) >= 'A' && (c) <= 'Z') \
+                             || ((c) >= '0' && (c) <= '9'))
+#define ASCII_LOWER(c)      (((c) >= 'A' && (c) <= 'Z') ? (c) + ('a' - 'A') : (c))
+#define ASCII_UPPER(c)      (((c) >= 'a' && (c) <= 'z') ? (c) - ('a' - 'A') : (c))
+
+// The tags of the HTML blocks that end only at their closing tag:
+static const char *const block_tag_names[] = {
+    "address", "blockquote", "center", "dd", "dir", "div", "dl", "dt",
+    "fieldset", "form", "frameset", "h1", "h2", "h3", "h4", "h5", "h6",
+    "head", "li", "menu", "noframes", "noscript", "ol", "p", "pre",
+    "script", "style", "table", "tbody", "td", "tfoot", "th", "thead", "tr",
+    "ul", NULL
+};
+
+/* Whether the line at `pos` of `text` is blank */
+static bool is_blank_line_at(const char *text, unsigned long pos,
+                             unsigned long len)
+{
+    while (pos < len && (text[pos] == ' ' || text[pos] == '\t'
+                         || text[pos] == '\r'))
+        pos++;
+    return (pos >= len || text[pos] == '\n');
+}
+
+/* Whether the tag at `pos` (a '<') opens `name`, in any case. This takes
+   more than the grammar does, which is on the safe side here. */
+static bool opens_tag(const char *text, unsigned long pos, unsigned long len,
+                      const char *name)
+{
+    unsigned long i = pos + 1;
+    while (i < len && (text[i] == ' ' || text[i] == '\t'
+                       || text[i] == '\n' || text[i] == '\r'))
+        i++;
+    for (; *name != '\0'; name++, i++) {
+        if (i >= len || ASCII_LOWER(text[i]) != *name)
+            return false;
+    }
+    return (i >= len || !IS_ASCII_ALNUM(text[i]));
+}
+
+/* End of the tag at `pos` (a '<') if it closes `name`, else 0. This takes
+   less than the grammar does, in all lower or upper case only. */
+static unsigned long closing_tag_end(const char *text, unsigned long pos,
+                                     unsigned long len, const char *name)
+{
+    unsigned long i = pos + 1;
+    while (i < len && (text[i] == ' ' || text[i] == '\t'))
+        i++;
+    if (i >= len || text[i] != '/')
+        return 0;
+    i++;
+    
+    bool upper = (i < len && text[i] >= 'A' && text[i] <= 'Z');
+    for (; *name != '\0'; name++, i++) {
+        if (i >= len || text[i] != (upper ? ASCII_UPPER(*name) : *name))
+            return 0;
+    }
+    while (i < len && (text[i] == ' ' || text[i] == '\t'))
+        i++;
+    return (i < len && text[i] == '>') ? i + 1 : 0;
+}
+
+/* How far the HTML block of `name` opened at `pos` may reach: to where
+   its tags are balanced */
+static unsigned long block_tag_end(const char *text, unsigned long pos,
+                                   unsigned long len, const char *name)
+{
+    unsigned long depth = 0;
+    unsigned long i;
+    for (i = pos; i < len; i++)
+    {
+        if (text[i] != '<')
+            continue;
+        if (opens_tag(text, i, len, name))
+            depth++;
+        else {
+            unsigned long end = closing_tag_end(text, i, len, name);
+            if (end != 0 && --depth == 0)
+                return end;
+        }
+    }
+    return len;
+}
+
+/* How far the HTML tag or comment at `pos` (a '<') may reach. Outside of
+   quoted attribute values, a tag cannot span a blank line. */
+static unsigned long tag_end(const char *text, unsigned long pos,
+                             unsigned long len)
+{
+    if (pos + 3 < len && strncmp(text + pos, "<!--", 4) == 0) {
+        unsigned long i;
+        for (i = pos + 4; i + 2 < len; i++) {
+            if (text[i] == '-' && text[i + 1] == '-' && text[i + 2] == '>')
+                return i + 3;
+        }
+        return len;
+    }
+    
+    unsigned long i = pos + 1;
+    while (i < len)
+    {
+        char c = text[i];
+        if (c == '>')
+            return i + 1;
+        if (c == '\n' && is_blank_line_at(text, i + 1, len))
+            return i + 1;
+        i++;
+        if (c != '=')
+            continue;
+        
+        // A quoted value may follow, after spaces and one newline:
+        while (i < len && (text[i] == ' ' || text[i] == '\t'))
+            i++;
+        if (i < len && text[i] == '\r')
+            i++;
+        if (i < len && text[i] == '\n')
+            i++;
+        while (i < len && (text[i] == ' ' || text[i] == '\t'))
+            i++;
+        if (i < len && (text[i] == '"' || text[i] == '\'')) {
+            const char *close = (const char *)memchr(text + i + 1, text[i],
+                                                     len - (i + 1));
+            if (close == NULL)
+                return len;
+            i = (unsigned long)(close - text) + 1;
+        }
+    }
+    return len;
+}
+
+/* How far the title of a link whose address starts at `pos` (a '(') may
+   reach. The title begins on the line of the '(' or the next one, and
+   ends at a closing quote followed by ')' or a newline. */
+static unsigned long link_title_end(const char *text, unsigned long pos,
+                                    unsigned long len)
+{
+    unsigned long end = pos;
+    int newlines = 0;
+    unsigned long i;
+    for (i = pos + 1; i < len && end < len; i++)
+    {
+        char quote = text[i];
+        if (quote == '\n' && ++newlines == 2)
+            break;
+        if (quote != '"' && quote != '\'')
+            continue;
+        
+        unsigned long j;
+        for (j = i + 1; j < len; j++)
+        {
+            if (text[j] != quote)
+                continue;
+            unsigned long k = j + 1;
+            while (k < len && (text[k] == ' ' || text[k] == '\t'))
+                k++;
+            if (k >= len || text[k] == ')' || text[k] == '\n'
+                || text[k] == '\r')
+                break;
+        }
+        if (j + 1 > end)
+            end = (j < len) ? j + 1 : len;
+    }
+    return end;
+}
+
+/*
+Find where to cut `text` (of `len` characters, without the "\n\n" suffix)
+into chunks of at least `min_size` characters. Return the number of
+chunks, and in `*out_starts` the start of each of them (the first one
+being 0), which the caller must free().
+
+A cut goes in front of a line that follows a blank line and starts with
+neither a space, nor a '>', nor a list marker. No block goes on over such
+a line: lists, blockquotes, indented code and footnotes would need it to
+start with a marker or an indent, and paragraphs end at the blank line. So
+only what can span blank lines is in the way: HTML blocks up to their
+closing tag, HTML comments, quoted values of HTML attributes, and titles
+of links. `horizon` is the farthest any of these that has begun so far
+may reach, judged on the safe side; the cut must not come before it.
+*/
+static size_t find_chunks(const char *text, unsigned long len,
+                          unsigned long min_size, unsigned long **out_starts)
+{
+    size_t starts_size = 16;
+    size_t num_chunks = 1;
+    unsigned long *starts = (unsigned long *)
+                            malloc(starts_size * sizeof(unsigned long));
+    starts[0] = 0;
+    
+    unsigned long horizon = 0;
+    bool line_blank = true;
+    bool line_start = true;
+    unsigned long i;
+    for (i = 0; i < len && horizon < len; i++)
+    {
+        char c = text[i];
+        
+        if (c == '<')
+        {
+            unsigned long end = tag_end(text, i, len);
+            if (end > horizon)
+                horizon = end;
+            
+            const char *const *name;
+            for (name = block_tag_names; *name != NULL; name++)
+            {
+                // HTML blocks start at the beginning of a line, but
+                // scripts also stand inline:
+                if ((line_start || strcmp(*name, "script") == 0)
+                    && opens_tag(text, i, len, *name))
+                {
+                    end = block_tag_end(text, i, len, *name);
+                    if (end > horizon)
+                        horizon = end;
+                    break;
+                }
+            }
+        }
+        else if (c == ']')
+        {
+            unsigned long j = i + 1;
+            while (j < len && (text[j] == ' ' || text[j] == '\t'
+                               || text[j] == '\n' || text[j] == '\r'))
+                j++;
+            if (j < len && text[j] == '(') {
+                unsigned long end = link_title_end(text, j, len);
+                if (end > horizon)
+                    horizon = end;
+            }
+        }
+        
+        line_start = (c == '\n' || c == '\r');
+        if (!line_start) {
+            if (c != ' ' && c != '\t')
+                line_blank = false;
+            continue;
+        }
+        if (c == '\r')
+            continue;
+        
+        // A line has ended at i:
+        unsigned long next = i + 1;
+        if (line_blank && next >= horizon
+            && next - starts[num_chunks - 1] >= min_size
+            && len - next >= min_size / 2
+            && strchr(" \t\r\n>+*-0123456789", text[next]) == NULL)
+        {
+            if (num_chunks == starts_size) {
+                starts_size *= 2;
+                starts = (unsigned long *)
+                         realloc(starts, starts_size * sizeof(unsigned long));
+            }
+            starts[num_chunks++] = next;
+        }
+        line_blank = true;
+    }
+    
+    *out_starts = starts;
+    return num_chunks;
+}
+
+
+// A mutex, condition variables and one-time initialization, for the
+// threads that parse chunks in parallel:
+#ifdef _WIN32
+typedef CRITICAL_SECTION pmh_mutex;
+typedef CONDITION_VARIABLE pmh_cond;
+typedef INIT_ONCE pmh_once;
+#define pmh_ONCE_INIT INIT_ONCE_STATIC_INIT
+#else
+typedef pthread_mutex_t pmh_mutex;
+typedef pthread_cond_t pmh_cond;
+typedef pthread_once_t pmh_once;
+#define pmh_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+static void mutex_init(pmh_mutex *mutex)
+{
+#ifdef _WIN32
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+static void mutex_lock(pmh_mutex *mutex)
+{
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+static void mutex_unlock(pmh_mutex *mutex)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+static void cond_init(pmh_cond *cond)
+{
+#ifdef _WIN32
+    InitializeConditionVariable(cond);
+#else
+    pthread_cond_init(cond, NULL);
+#endif
+}
+
+static void cond_wait(pmh_cond *cond, pmh_mutex *mutex)
+{
+#ifdef _WIN32
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+static void cond_broadcast(pmh_cond *cond)
+{
+#ifdef _WIN32
+    WakeAllConditionVariable(cond);
+#else
+    pthread_cond_broadcast(cond);
+#endif
+}
+
+// A chunk of the text, parsed on its own:
+typedef struct
+{
+    /* The pmh_RAW span of the chunk in the text: */
+    pmh_realelement span;
+    
+    /* Its own cancellation and budget state, copied from those of the */
+    /* whole parse: */
+    pmh_cancellation cancellation;
+    pmh_budget budget;
+    
+    /* The result of the chunk (NULL until parsed): */
+    pmh_realelement **head_elems;
+} pmh_chunk;
+
+// The chunks of a parallel parse, which its threads take one by one:
+typedef struct pmh_ParallelParse
+{
+    /* The parse of the whole text, after its reference pass: */
+    parser_data *p_data;
+    
+    pmh_chunk *chunks;
+    size_t num_chunks;
+    
+    /* Length of the longest chunk: */
+    unsigned long max_chunk_len;
+    
+    /* The rest is under the mutex of the thread pool. */
+    
+    /* The next chunk to take, and whether a chunk has been cancelled: */
+    size_t next_chunk;
+    bool cancelled;
+    
+    /* The next parse posted to the pool, and how many of its threads may */
+    /* help with this one and do: */
+    struct pmh_ParallelParse *next_parse;
+    size_t max_helpers;
+    size_t num_helpers;
+} pmh_parallel_parse;
+
+/*
+The threads that help the calling ones with parallel parses. They are
+started as parses first ask for them and then kept for all parses to come,
+each with its parser context (see acquire_context()), so that a parse
+neither starts threads nor sets up contexts. A parse is posted to the pool
+until its chunks run out; helpers idle in the pool take it up, as many as
+it asks for. Parses of texts on several threads at once thus share the
+helpers, rather than each starting as many threads as there are cores.
+*/
+#ifndef pmh_THREAD_POOL_MAX
+#define pmh_THREAD_POOL_MAX 64
+#endif
+
+typedef struct
+{
+    pmh_mutex mutex;
+    
+    /* Signalled when a parse is posted, and when a helper leaves one: */
+    pmh_cond posted;
+    pmh_cond left;
+    
+    /* The parses posted, in order: */
+    pmh_parallel_parse *parses;
+    
+    size_t num_threads;
+} pmh_thread_pool;
+
+static pmh_thread_pool thread_pool;
+static pmh_once thread_pool_once = pmh_ONCE_INIT;
+
+#ifdef _WIN32
+static BOOL CALLBACK init_thread_pool(PINIT_ONCE once, PVOID param,
+                                      PVOID *context)
+#else
+static void init_thread_pool(void)
+#endif
+{
+    mutex_init(&thread_pool.mutex);
+    cond_init(&thread_pool.posted);
+    cond_init(&thread_pool.left);
+    thread_pool.parses = NULL;
+    thread_pool.num_threads = 0;
+#ifdef _WIN32
+    return TRUE;
+#endif
+}
+
+/* Take `parallel` off the pool, if it is posted (under the pool mutex) */
+static void unpost_parse(pmh_parallel_parse *parallel)
+{
+    pmh_parallel_parse **link = &thread_pool.parses;
+    while (*link != NULL && *link != parallel)
+        link = &(*link)->next_parse;
+    if (*link != NULL)
+        *link = parallel->next_parse;
+}
+
+/* Parse `chunk` into a result of its own, with `context` */
+static void parse_chunk(pmh_parallel_parse *parallel, pmh_chunk *chunk,
+                        pmh_parse_context *context)
+{
+    parser_data *p_data = parallel->p_data;
+    parser_data *chunk_p_data = mk_parser_data(
+        p_data->original_input,
+        p_data->original_utf16,
+        p_data->strip_positions,
+        p_data->strip_positions_len,
+        p_data->charbuf,
+        p_data->charbuf_len,
+        &chunk->span,
+        chunk->span.pos,
+        p_data->extensions,
+        NULL,
+        NULL,
+        p_data->references
+    );
+    chunk_p_data->reference_table = p_data->reference_table;
+    if (p_data->cancellation != NULL)
+        chunk_p_data->cancellation = &chunk->cancellation;
+    chunk_p_data->budget = &chunk->budget;
+    chunk_p_data->context = context;
+    
+    if (!is_cancelled(chunk_p_data, true)) {
+        parse_markdown(chunk_p_data);
+        process_raw_blocks(chunk_p_data);
+    }
+    
+    chunk->head_elems = chunk_p_data->head_elems;
+    free_parser_data(chunk_p_data);
 }
 
-
-#if pmh_DEBUG_OUTPUT
-static void print_raw_blocks(char *text, pmh_realelement *elem[])
+/* Parse chunks of `parallel` with `context` until there are none left */
+static void parse_chunks(pmh_parallel_parse *parallel,
+                         pmh_parse_context *context)
 {
-    pmh_PRINTF("--------print_raw_blocks---------\n");
-    pmh_PRINTF("block:\n");
-    pmh_realelement *cursor = elem[pmh_RAW_LIST];
-    while (cursor != NULL)
+    while (true)
     {
-        print_raw_spans_inline(cursor->children);
-        cursor = cursor->next;
+        // Once the chunks run out, no more helpers need to come:
+        pmh_chunk *chunk = NULL;
+        mutex_lock(&thread_pool.mutex);
+        if (!parallel->cancelled && parallel->next_chunk < parallel->num_chunks)
+            chunk = &parallel->chunks[parallel->next_chunk++];
+        else
+            unpost_parse(parallel);
+        mutex_unlock(&thread_pool.mutex);
+        if (chunk == NULL)
+            return;
+        
+        parse_chunk(parallel, chunk, context);
+        
+        if (chunk->cancellation.cancelled) {
+            mutex_lock(&thread_pool.mutex);
+            parallel->cancelled = true;
+            mutex_unlock(&thread_pool.mutex);
+        }
     }
 }
-#endif
 
+/* A helper of the pool: it takes up posted parses until the process ends */
+#ifdef _WIN32
+static unsigned __stdcall pool_thread(void *arg)
+#else
+static void *pool_thread(void *arg)
+#endif
+{
+    (void)arg;
+    mutex_lock(&thread_pool.mutex);
+    while (true)
+    {
+        pmh_parallel_parse *parallel = thread_pool.parses;
+        while (parallel != NULL
+               && parallel->num_helpers >= parallel->max_helpers)
+            parallel = parallel->next_parse;
+        if (parallel == NULL) {
+            cond_wait(&thread_pool.posted, &thread_pool.mutex);
+            continue;
+        }
+        parallel->num_helpers++;
+        mutex_unlock(&thread_pool.mutex);
+        
+        // The context stays with the thread, for its next parse
+        pmh_parse_context *context = acquire_context(parallel->max_chunk_len);
+        parse_chunks(parallel, context);
+        release_context(context);
+        
+        mutex_lock(&thread_pool.mutex);
+        parallel->num_helpers--;
+        cond_broadcast(&thread_pool.left);
+    }
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
 
+static bool start_pool_thread(void)
+{
+#ifdef _WIN32
+    HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, pool_thread, NULL, 0,
+                                           NULL);
+    if (thread == 0)
+        return false;
+    CloseHandle(thread);
+    return true;
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, pool_thread, NULL) != 0)
+        return false;
+    pthread_detach(thread);
+    return true;
+#endif
+}
 
+/* Have up to `max_helpers` helpers of the pool, started as needed, help
+   with `parallel`, and parse its chunks on the calling thread with them.
+   Return once all chunks are done. */
+static void parse_with_pool(pmh_parallel_parse *parallel, size_t max_helpers)
+{
+#ifdef _WIN32
+    InitOnceExecuteOnce(&thread_pool_once, init_thread_pool, NULL, NULL);
+#else
+    pthread_once(&thread_pool_once, init_thread_pool);
+#endif
+    if (max_helpers > pmh_THREAD_POOL_MAX)
+        max_helpers = pmh_THREAD_POOL_MAX;
+    
+    mutex_lock(&thread_pool.mutex);
+    while (thread_pool.num_threads < max_helpers && start_pool_thread())
+        thread_pool.num_threads++;
+    parallel->next_parse = NULL;
+    parallel->max_helpers = max_helpers;
+    parallel->num_helpers = 0;
+    pmh_parallel_parse **link = &thread_pool.parses;
+    while (*link != NULL)
+        link = &(*link)->next_parse;
+    *link = parallel;
+    cond_broadcast(&thread_pool.posted);
+    mutex_unlock(&thread_pool.mutex);
+    
+    parse_chunks(parallel, parallel->p_data->context);
+    
+    mutex_lock(&thread_pool.mutex);
+    unpost_parse(parallel);
+    while (parallel->num_helpers > 0)
+        cond_wait(&thread_pool.left, &thread_pool.mutex);
+    mutex_unlock(&thread_pool.mutex);
+}
 
-/* Free all elements created while parsing */
-void pmh_free_elements(pmh_element **elems)
+/* Append the result of `chunk` to that of `p_data`, arena and all. The
+   lists of the types private to the parser are left out, except for that
+   of all elements. */
+static void merge_chunk(parser_data *p_data, pmh_chunk *chunk)
 {
-    pmh_realelement *cursor = (pmh_realelement*)elems[pmh_ALL];
-    while (cursor != NULL) {
-        pmh_realelement *tofree = cursor;
-        cursor = cursor->all_elems_next;
-        if (tofree->text != NULL)
-            free(tofree->text);
-        if (tofree->label != NULL)
-            free(tofree->label);
-        if (tofree->address != NULL)
-            free(tofree->address);
-        free(tofree);
+    int type;
+    for (type = 0; type < pmh_NUM_LANG_TYPES; type++)
+    {
+        pmh_realelement *elems = chunk->head_elems[type];
+        if (elems == NULL)
+            continue;
+        pmh_realelement *last = elems;
+        while (last->next != NULL)
+            last = last->next;
+        last->next = p_data->head_elems[type];
+        p_data->head_elems[type] = elems;
     }
-    elems[pmh_ALL] = NULL;
     
-    free(elems);
+    pmh_realelement *all_elems = chunk->head_elems[pmh_ALL];
+    if (all_elems != NULL) {
+        pmh_realelement *last = all_elems;
+        while (last->all_elems_next != NULL)
+            last = last->all_elems_next;
+        last->all_elems_next = p_data->head_elems[pmh_ALL];
+        p_data->head_elems[pmh_ALL] = all_elems;
+    }
+    
+    if (chunk->budget.unparsed != NULL) {
+        pmh_range *last = chunk->budget.unparsed;
+        while (last->next != NULL)
+            last = last->next;
+        last->next = p_data->budget->unparsed;
+        p_data->budget->unparsed = chunk->budget.unparsed;
+    }
+    if (chunk->budget.exhausted)
+        p_data->budget->exhausted = true;
+    if (chunk->cancellation.cancelled)
+        p_data->cancellation->cancelled = true;
+    
+    // The arena of p_data keeps allocating from its first chunk, so the
+    // others go behind it:
+    pmh_result *result = (pmh_result *)((char *)chunk->head_elems
+                                        - offsetof(pmh_result, head_elems));
+    pmh_arena_chunk **tail = &p_data->arena->chunks;
+    while (*tail != NULL)
+        tail = &(*tail)->next;
+    *tail = result->arena.chunks;
+    free(result);
+    chunk->head_elems = NULL;
 }
 
-
-
-
-
-
-#define IS_CONTINUATION_BYTE(x) ((x & 0xC0) == 0x80)
-#define HAS_UTF8_BOM(x)         ( ((*x & 0xFF) == 0xEF)\
-                                  && ((*(x+1) & 0xFF) == 0xBB)\
-                                  && ((*(x+2) & 0xFF) == 0xBF) )
-#define ADD_STRIP_POS(x) \
-    /* reallocate more space for the array, if needed: */ \
-    if (strip_positions_size <= strip_positions_pos) { \
-        size_t new_size = strip_positions_size * 2; \
-        unsigned long *new_arr = (unsigned long *) \
-                                 calloc(new_size, \
-                                        sizeof(unsigned long)); \
-        memcpy(new_arr, strip_positions, \
-               (sizeof(unsigned long) * strip_positions_size)); \
-        strip_positions_size = new_size; \
-        free(strip_positions); \
-        strip_positions = new_arr; \
-    } \
-    strip_positions[strip_positions_pos] = x; \
-    strip_positions_pos++;
-
 /*
-Copy `str` to `out`, while doing the following:
-  - remove UTF-8 continuation bytes
-  - remove possible UTF-8 BOM (byte order mark)
-  - append two newlines to the end (like peg-markdown does)
-  - keep track of which bytes we have stripped (in strip_positions)
+Parse the text of `p_data`, whose reference pass is done, in chunks on up
+to `num_threads` threads, the calling one included. Return false, having
+done nothing, if the text is too short for more than one chunk.
+
+Each chunk has the budget that is left for the whole text: its steps are
+counted in each chunk on its own, while the deadline is common to all.
 */
-static int strcpy_preformat(char *str, char **out,
-                            unsigned long **out_strip_positions,
-                            size_t *out_strip_positions_len)
+static bool parse_in_parallel(parser_data *p_data, int num_threads)
 {
-    size_t strip_positions_size = 1024;
-    size_t strip_positions_pos = 0;
-    unsigned long *strip_positions = (unsigned long *)
-                                     calloc(strip_positions_size,
-                                            sizeof(unsigned long));
-    
-    
-    // +2 in the following is due to the "\n\n" suffix:
-    char *new_str = (char *)malloc(sizeof(char) * strlen(str) + 1 + 2);
-    char *c = str;
-    int i = 0;
+    unsigned long len = p_data->budget->text_len;
+    unsigned long min_size = len / ((unsigned long)num_threads
+                                    * pmh_CHUNKS_PER_THREAD);
+    if (min_size < pmh_CHUNK_SIZE_MIN)
+        min_size = pmh_CHUNK_SIZE_MIN;
     
-    if (HAS_UTF8_BOM(c)) {
-        c += 3;
-        ADD_STRIP_POS(0);
-        ADD_STRIP_POS(1);
-        ADD_STRIP_POS(2);
+    unsigned long *starts = NULL;
+    size_t num_chunks = find_chunks(p_data->charbuf, len, min_size, &starts);
+    if (num_chunks < 2) {
+        free(starts);
+        return false;
     }
     
-    while (*c != '\0')
+    pmh_parallel_parse parallel;
+    parallel.p_data = p_data;
+    parallel.chunks = (pmh_chunk *)malloc(num_chunks * sizeof(pmh_chunk));
+    parallel.num_chunks = num_chunks;
+    parallel.max_chunk_len = 0;
+    parallel.next_chunk = 0;
+    parallel.cancelled = false;
+    
+    size_t i;
+    for (i = 0; i < num_chunks; i++)
     {
-        if (!IS_CONTINUATION_BYTE(*c)) {
-            *(new_str+i) = *c, i++;
-        } else {
-            ADD_STRIP_POS((int)(c-str));
-        }
-        c++;
+        pmh_chunk *chunk = &parallel.chunks[i];
+        chunk->span.type = pmh_RAW;
+        chunk->span.pos = starts[i];
+        chunk->span.end = (i + 1 < num_chunks) ? starts[i + 1] : len + 2;
+        chunk->span.next = NULL;
+        if (chunk->span.end - chunk->span.pos > parallel.max_chunk_len)
+            parallel.max_chunk_len = chunk->span.end - chunk->span.pos;
+        
+        if (p_data->cancellation != NULL)
+            chunk->cancellation = *p_data->cancellation;
+        else
+            chunk->cancellation.callback = NULL;
+        chunk->cancellation.countdown = pmh_CANCEL_POLL_INTERVAL;
+        chunk->cancellation.cancelled = false;
+        chunk->budget = *p_data->budget;
+        chunk->budget.countdown = 0;
+        chunk->budget.unparsed = NULL;
+        chunk->head_elems = NULL;
     }
+    free(starts);
     
-    *(new_str+(i++)) = '\n';
-    *(new_str+(i++)) = '\n';
-    *(new_str+i) = '\0';
+    size_t max_helpers = ((size_t)num_threads < num_chunks)
+                         ? (size_t)num_threads - 1
+                         : num_chunks - 1;
+    parse_with_pool(&parallel, max_helpers);
     
-    *out = new_str;
-    *out_strip_positions = strip_positions;
-    *out_strip_positions_len = strip_positions_pos;
-    return i;
+    for (i = 0; i < num_chunks; i++) {
+        if (parallel.chunks[i].head_elems != NULL)
+            merge_chunk(p_data, &parallel.chunks[i]);
+    }
+    free(parallel.chunks);
+    return true;
 }
 
 
@@ -500,57 +1843,204 @@ static int strcpy_preformat(char *str, char **out,
 void pmh_markdown_to_elements(char *text, int extensions,
                               pmh_element **out_result[])
 {
-    char *text_copy = NULL;
-    unsigned long *strip_positions = NULL;
-    size_t strip_positions_len = 0;
-    int text_copy_len = strcpy_preformat(text, &text_copy, &strip_positions,
-                                         &strip_positions_len);
-    
+    pmh_markdown_to_elements_budgeted(text, extensions, NULL, NULL, NULL,
+                                      out_result, NULL);
+}
+
+bool pmh_markdown_to_elements_cancellable(char *text, int extensions,
+                                          pmh_cancel_callback cancel,
+                                          void *cancel_context,
+                                          pmh_element **out_result[])
+{
+    return pmh_markdown_to_elements_budgeted(text, extensions, NULL,
+                                             cancel, cancel_context,
+                                             out_result, NULL);
+}
+
+bool pmh_markdown_to_elements_budgeted(char *text, int extensions,
+                                       const pmh_parse_budget *budget,
+                                       pmh_cancel_callback cancel,
+                                       void *cancel_context,
+                                       pmh_element **out_result[],
+                                       pmh_range **out_unparsed)
+{
+    return pmh_markdown_to_elements_parallel(text, extensions, 1, budget,
+                                             cancel, cancel_context,
+                                             out_result, out_unparsed);
+}
+
+bool pmh_markdown_to_elements_parallel(char *text, int extensions,
+                                       int num_threads,
+                                       const pmh_parse_budget *budget,
+                                       pmh_cancel_callback cancel,
+                                       void *cancel_context,
+                                       pmh_element **out_result[],
+                                       pmh_range **out_unparsed)
+{
+    return pmh_markdown_buffer_to_elements(text, strlen(text), extensions,
+                                           num_threads, budget,
+                                           cancel, cancel_context,
+                                           out_result, out_unparsed);
+}
+
+/*
+Parse the `text_len` characters at `charbuf`, prepared by preformat() from
+the UTF-8 at `data`, or by preformat_utf16() from the UTF-16 at `utf16`,
+for pmh_markdown_buffer_to_elements() and pmh_markdown_utf16_to_elements()
+*/
+static bool parse_text(const char *data, const unsigned short *utf16,
+                       unsigned long *strip_positions,
+                       size_t strip_positions_len,
+                       const char *charbuf, unsigned long text_len,
+                       int extensions, int num_threads,
+                       const pmh_parse_budget *budget,
+                       pmh_cancel_callback cancel,
+                       void *cancel_context,
+                       pmh_element **out_result[],
+                       pmh_range **out_unparsed)
+{
+    // Parse the text with the "\n\n" suffix:
     pmh_realelement *parsing_elem = (pmh_realelement *)
                                     malloc(sizeof(pmh_realelement));
     parsing_elem->type = pmh_RAW;
     parsing_elem->pos = 0;
-    parsing_elem->end = text_copy_len;
+    parsing_elem->end = text_len + 2;
     parsing_elem->next = NULL;
     
     parser_data *p_data = mk_parser_data(
-        text,
+        data,
+        utf16,
         strip_positions,
         strip_positions_len,
-        text_copy,
+        charbuf,
+        text_len,
         parsing_elem,
         0,
         extensions,
         NULL,
+        NULL,
         NULL
     );
     pmh_realelement **result = p_data->head_elems;
     
-    if (*text_copy != '\0')
+    pmh_cancellation cancellation;
+    cancellation.callback = cancel;
+    cancellation.context = cancel_context;
+    cancellation.countdown = pmh_CANCEL_POLL_INTERVAL;
+    cancellation.cancelled = false;
+    if (cancel != NULL)
+        p_data->cancellation = &cancellation;
+    
+    pmh_budget budget_state;
+    budget_state.countdown = 0;
+    budget_state.steps = (budget != NULL && budget->max_steps != 0)
+                         ? budget->max_steps
+                         : ULONG_MAX;
+    budget_state.deadline = (budget != NULL && budget->max_msecs != 0)
+                            ? pmh_msecs() + budget->max_msecs
+                            : 0;
+    budget_state.exhausted = false;
+    budget_state.text_len = text_len;
+    budget_state.unparsed = NULL;
+    p_data->budget = &budget_state;
+    p_data->context = acquire_context(text_len + 2);
+    
+    if (!is_cancelled(p_data, true))
     {
         // Get reference definitions into p_data->references
         parse_references(p_data);
         
-        // Reset parser state to beginning of input
-        p_data->offset = 0;
-        p_data->current_elem = p_data->elem_head;
-        
-        // Parse whole document
-        parse_markdown(p_data);
-        
-        #if pmh_DEBUG_OUTPUT
-        print_raw_blocks(text_copy, result);
-        #endif
-        
-        process_raw_blocks(p_data);
+        // Without all of them, no link can be told from plain text
+        if (budget_state.exhausted)
+            add_unparsed(p_data, 0, budget_state.text_len);
+        else if (!is_cancelled(p_data, true)
+                 && (num_threads < 2 || !parse_in_parallel(p_data, num_threads)))
+        {
+            // Reset parser state to beginning of input
+            p_data->offset = 0;
+            p_data->current_elem = p_data->elem_head;
+            
+            // Parse whole document
+            parse_markdown(p_data);
+            
+            #if pmh_DEBUG_OUTPUT
+            print_raw_blocks(charbuf, result);
+            #endif
+            
+            process_raw_blocks(p_data);
+        }
     }
     
-    free(strip_positions);
-    free(p_data);
+    release_context(p_data->context);
+    free_parser_data(p_data);
     free(parsing_elem);
-    free(text_copy);
+    
+    if (cancellation.cancelled) {
+        pmh_free_elements((pmh_element**)result);
+        result = NULL;
+    }
     
     *out_result = (pmh_element**)result;
+    if (out_unparsed != NULL)
+        *out_unparsed = cancellation.cancelled ? NULL : budget_state.unparsed;
+    return !cancellation.cancelled;
+}
+
+bool pmh_markdown_buffer_to_elements(const char *data, size_t len,
+                                     int extensions, int num_threads,
+                                     const pmh_parse_budget *budget,
+                                     pmh_cancel_callback cancel,
+                                     void *cancel_context,
+                                     pmh_element **out_result[],
+                                     pmh_range **out_unparsed)
+{
+    // The text ends at a NUL byte, as a C string would:
+    const char *nul = (const char *)memchr(data, '\0', len);
+    if (nul != NULL)
+        len = nul - data;
+    
+    char *text_copy = NULL;
+    unsigned long *strip_positions = NULL;
+    size_t strip_positions_len = 0;
+    unsigned long text_len = preformat(data, len, &text_copy,
+                                       &strip_positions, &strip_positions_len);
+    const char *charbuf = (text_copy != NULL) ? text_copy : data;
+    
+    pmh_range *unparsed = NULL;
+    bool ret = parse_text(data, NULL, strip_positions, strip_positions_len,
+                          charbuf, text_len, extensions, num_threads, budget,
+                          cancel, cancel_context, out_result, &unparsed);
+    // Pure ASCII has nothing outside of the BMP
+    if (ret && (extensions & pmh_EXT_UTF16_OFFSETS) && text_copy != NULL)
+        offsets_to_utf16(charbuf, text_len, *out_result, unparsed);
+    if (out_unparsed != NULL)
+        *out_unparsed = unparsed;
+    free(strip_positions);
+    free(text_copy);
+    return ret;
+}
+
+bool pmh_markdown_utf16_to_elements(const unsigned short *data, size_t len,
+                                    int extensions, int num_threads,
+                                    const pmh_parse_budget *budget,
+                                    pmh_cancel_callback cancel,
+                                    void *cancel_context,
+                                    pmh_element **out_result[],
+                                    pmh_range **out_unparsed)
+{
+    char *text_copy = NULL;
+    unsigned long *strip_positions = NULL;
+    size_t strip_positions_len = 0;
+    unsigned long text_len = preformat_utf16(data, len, &text_copy,
+                                             &strip_positions,
+                                             &strip_positions_len);
+    
+    bool ret = parse_text(NULL, data, strip_positions, strip_positions_len,
+                          text_copy, text_len, extensions, num_threads, budget,
+                          cancel, cancel_context, out_result, out_unparsed);
+    free(strip_positions);
+    free(text_copy);
+    return ret;
 }
 
 
@@ -655,18 +2145,126 @@ static bool extension(parser_data *p_data, int ext)
     return ((p_data->extensions & ext) != 0);
 }
 
-/* return reference pmh_realelement for a given label */
+#define IS_LABEL_SPACE(x) ((x) == ' ' || (x) == '\t' || (x) == '\n' || (x) == '\r')
+
+/*
+Return the next character of a label as labels are compared, and advance
+`*cursor` past it: ASCII letters in lower case, each run of whitespace as a
+single space, and '\0' at the end, including for whitespace at the end.
+Whitespace at the start must have been skipped by the caller.
+*/
+static char next_label_char(const char **cursor)
+{
+    const char *c = *cursor;
+    if (IS_LABEL_SPACE(*c)) {
+        while (IS_LABEL_SPACE(*c))
+            c++;
+        *cursor = c;
+        return (*c == '\0') ? '\0' : ' ';
+    }
+    if (*c == '\0')
+        return '\0';
+    *cursor = c + 1;
+    return ('A' <= *c && *c <= 'Z') ? (*c - 'A' + 'a') : *c;
+}
+
+static const char *skip_label_space(const char *label)
+{
+    while (IS_LABEL_SPACE(*label))
+        label++;
+    return label;
+}
+
+static unsigned long label_hash(const char *label)
+{
+    /* FNV-1a */
+    unsigned long hash = 2166136261UL;
+    const char *c = skip_label_space(label);
+    char ch;
+    while ((ch = next_label_char(&c)) != '\0')
+        hash = ((hash ^ (unsigned char)ch) * 16777619UL) & 0xFFFFFFFFUL;
+    return hash;
+}
+
+static bool labels_equal(const char *a, const char *b)
+{
+    a = skip_label_space(a);
+    b = skip_label_space(b);
+    char ch;
+    do {
+        ch = next_label_char(&a);
+        if (ch != next_label_char(&b))
+            return false;
+    } while (ch != '\0');
+    return true;
+}
+
+/*
+Index p_data->references by label. Where several definitions have the same
+label, the first one in the list is found, as when walking it.
+*/
+static void build_reference_table(parser_data *p_data)
+{
+    size_t count = 0;
+    pmh_realelement *cursor;
+    for (cursor = p_data->references; cursor != NULL; cursor = cursor->next)
+        count++;
+    
+    pmh_reference_table *table = (pmh_reference_table *)
+        arena_alloc(p_data->arena, sizeof(pmh_reference_table), p_data);
+    table->num_buckets = 16;
+    while (table->num_buckets < count * 2)
+        table->num_buckets *= 2;
+    table->buckets = (pmh_reference_entry **)
+        arena_alloc(p_data->arena,
+                    sizeof(pmh_reference_entry *) * table->num_buckets, p_data);
+    memset(table->buckets, 0, sizeof(pmh_reference_entry *) * table->num_buckets);
+    
+    for (cursor = p_data->references; cursor != NULL; cursor = cursor->next)
+    {
+        if (cursor->label == NULL)
+            continue;
+        unsigned long hash = label_hash(cursor->label);
+        pmh_reference_entry **bucket =
+            &table->buckets[hash & (table->num_buckets - 1)];
+        
+        pmh_reference_entry *entry;
+        for (entry = *bucket; entry != NULL; entry = entry->next) {
+            if (entry->hash == hash
+                && labels_equal(entry->reference->label, cursor->label))
+                break;
+        }
+        if (entry != NULL)
+            continue;
+        
+        entry = (pmh_reference_entry *)
+            arena_alloc(p_data->arena, sizeof(pmh_reference_entry), p_data);
+        entry->hash = hash;
+        entry->reference = cursor;
+        entry->next = *bucket;
+        *bucket = entry;
+    }
+    
+    p_data->reference_table = table;
+}
+
+/*
+return reference pmh_realelement for a given label. As in Markdown, labels
+match regardless of ASCII case and of the amount of whitespace.
+*/
 static pmh_realelement *get_reference(parser_data *p_data, char *label)
 {
-    if (!label)
+    if (!label || p_data->reference_table == NULL)
         return NULL;
     
-    pmh_realelement *cursor = p_data->references;
-    while (cursor != NULL)
+    pmh_reference_table *table = p_data->reference_table;
+    unsigned long hash = label_hash(label);
+    pmh_reference_entry *entry = table->buckets[hash & (table->num_buckets - 1)];
+    while (entry != NULL)
     {
-        if (cursor->label && strcmp(label, cursor->label) == 0)
-            return cursor;
-        cursor = cursor->next;
+        if (entry->hash == hash && labels_equal(entry->reference->label, label))
+            return entry->reference;
+        entry = entry->next;
     }
     return NULL;
 }
@@ -707,7 +2305,9 @@ static pmh_realelement *reverse(pmh_realelement *list)
 static pmh_realelement *mk_element(parser_data *p_data, pmh_element_type type,
                                    long pos, long end)
 {
-    pmh_realelement *result = (pmh_realelement *)malloc(sizeof(pmh_realelement));
+    pmh_realelement *result = (pmh_realelement *)
+                              arena_alloc(p_data->arena, sizeof(pmh_realelement),
+                                          p_data);
     memset(result, 0, sizeof(*result));
     result->type = type;
     result->pos = pos;
@@ -725,9 +2325,11 @@ static pmh_realelement *mk_element(parser_data *p_data, pmh_element_type type,
 static pmh_realelement *copy_element(parser_data *p_data, pmh_realelement *elem)
 {
     pmh_realelement *result = mk_element(p_data, elem->type, elem->pos, elem->end);
-    result->label = strdup_or_null(elem->label);
-    result->text = strdup_or_null(elem->text);
-    result->address = strdup_or_null(elem->address);
+    // strings in the arena stay as they are until the result is freed, so
+    // copies of an element may share them:
+    result->label = elem->label;
+    result->text = elem->text;
+    result->address = elem->address;
     return result;
 }
 
@@ -737,11 +2339,69 @@ static pmh_realelement *mk_etext(parser_data *p_data, char *string)
     pmh_realelement *result;
     assert(string != NULL);
     result = mk_element(p_data, pmh_EXTRA_TEXT, 0,0);
-    result->text = strdup_or_null(string);
+    result->text = string;
     return result;
 }
 
 
+/*
+Index the spans to parse (p_data->elem_head) by their range in the parsed
+text. The spans do not change while a parser runs over them.
+*/
+static void build_span_index(parser_data *p_data)
+{
+    size_t len = 0;
+    pmh_realelement *cursor;
+    for (cursor = p_data->elem_head; cursor != NULL; cursor = cursor->next)
+        len++;
+    
+    if (len + 1 > p_data->span_index_size) {
+        free(p_data->span_index);
+        p_data->span_index_size = len + 1;
+        p_data->span_index = (pmh_span_index_entry *)
+            malloc(sizeof(pmh_span_index_entry) * p_data->span_index_size);
+    }
+    pmh_span_index_entry *index = p_data->span_index;
+    unsigned long c = 0;
+    unsigned long previous_end = 0;
+    size_t i = 0;
+    for (cursor = p_data->elem_head; cursor != NULL; cursor = cursor->next)
+    {
+        int thislen = (cursor->type == pmh_EXTRA_TEXT)
+                        ? strlen(cursor->text)
+                        : cursor->end - cursor->pos;
+        index[i].span = cursor;
+        index[i].parsed_pos = c;
+        index[i].parsed_end = c + thislen;
+        index[i].previous_end = previous_end;
+        if (cursor->type != pmh_EXTRA_TEXT)
+            previous_end = cursor->end;
+        c += thislen;
+        i++;
+    }
+    
+    p_data->span_index_len = len;
+    p_data->span_index_built = true;
+}
+
+/*
+Return the index of the first span whose range in the parsed text reaches
+`pos`, or the number of spans if there is none.
+*/
+static size_t find_span(parser_data *p_data, unsigned long pos)
+{
+    size_t lo = 0, hi = p_data->span_index_len;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (p_data->span_index[mid].parsed_end < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
 /*
 Given an element where the offsets {pos, end} represent
 locations in the *parsed text* (defined by the linked list of pmh_RAW and
@@ -763,15 +2423,22 @@ static pmh_realelement *fix_offsets(parser_data *p_data, pmh_realelement *elem)
     bool found_start = false;
     bool found_end = false;
     bool tail_needs_pos = false;
-    unsigned long previous_end = 0;
-    unsigned long c = 0;
     
-    pmh_realelement *cursor = p_data->elem_head;
-    while (cursor != NULL)
+    if (!p_data->span_index_built)
+        build_span_index(p_data);
+    
+    // Spans ending in front of elem->pos contain neither end of elem; start
+    // with the first one that may contain its start:
+    size_t i = find_span(p_data, elem->pos);
+    unsigned long previous_end = (i < p_data->span_index_len)
+                                 ? p_data->span_index[i].previous_end
+                                 : 0;
+    
+    for (; i < p_data->span_index_len; i++)
     {
-        int thislen = (cursor->type == pmh_EXTRA_TEXT)
-                        ? strlen(cursor->text)
-                        : cursor->end - cursor->pos;
+        pmh_realelement *cursor = p_data->span_index[i].span;
+        unsigned long c = p_data->span_index[i].parsed_pos;
+        int thislen = p_data->span_index[i].parsed_end - c;
         
         if (tail_needs_pos && cursor->type != pmh_EXTRA_TEXT) {
             tail->pos = cursor->pos;
@@ -813,15 +2480,72 @@ static pmh_realelement *fix_offsets(parser_data *p_data, pmh_realelement *elem)
             prev = new_elem;
             tail_needs_pos = true;
         }
-        
-        c += thislen;
-        cursor = cursor->next;
     }
     
     return new_head;
 }
 
 
+/*
+Record the range [pos, end) of charbuf as unparsed, see
+pmh_markdown_to_elements_budgeted(). A range touching the one recorded
+last is joined with it.
+*/
+static void add_unparsed(parser_data *p_data, unsigned long pos, unsigned long end)
+{
+    pmh_budget *b = p_data->budget;
+    if (end > b->text_len)
+        end = b->text_len;
+    if (end <= pos)
+        return;
+    
+    pmh_range *last = b->unparsed;
+    if (last != NULL && last->pos <= end && pos <= last->end) {
+        if (pos < last->pos)
+            last->pos = pos;
+        if (end > last->end)
+            last->end = end;
+        return;
+    }
+    
+    pmh_range *range = (pmh_range *)arena_alloc(p_data->arena, sizeof(pmh_range),
+                                                p_data);
+    range->pos = pos;
+    range->end = end;
+    range->next = b->unparsed;
+    b->unparsed = range;
+}
+
+/* Record the pmh_RAW spans in the list `spans` as unparsed */
+static void add_unparsed_spans(parser_data *p_data, pmh_realelement *spans)
+{
+    for (; spans != NULL; spans = spans->next)
+    {
+        if (spans->type == pmh_RAW)
+            add_unparsed(p_data, spans->pos, spans->end);
+    }
+}
+
+/* Record the text of the spans to parse from `parsed_pos` on as unparsed */
+static void add_unparsed_from(parser_data *p_data, unsigned long parsed_pos)
+{
+    if (!p_data->span_index_built)
+        build_span_index(p_data);
+    
+    size_t i;
+    for (i = find_span(p_data, parsed_pos); i < p_data->span_index_len; i++)
+    {
+        pmh_span_index_entry *entry = &p_data->span_index[i];
+        if (entry->span->type != pmh_RAW)
+            continue;
+        unsigned long skipped = (parsed_pos > entry->parsed_pos)
+                                ? parsed_pos - entry->parsed_pos
+                                : 0;
+        add_unparsed(p_data, entry->span->pos + skipped, entry->span->end);
+    }
+}
+
+
 
 /* Add an element to p_data->head_elems. */
 static void add(parser_data *p_data, pmh_realelement *elem)
@@ -874,74 +2598,360 @@ static void add(parser_data *p_data, pmh_realelement *elem)
     }
 }
 
-
+
+/*
+Map an offset in p_data->charbuf to the corresponding offset in
+p_data->original_input. Every stripped byte in front of the original offset
+moves it by one. strip_positions is ascending, so strip_positions[i] - i
+never decreases, and the stripped bytes in front are those with
+strip_positions[i] - i <= offset: a binary search finds their number.
+*/
+static unsigned long original_offset(parser_data *p_data, unsigned long offset)
+{
+    size_t lo = 0, hi = p_data->strip_positions_len;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (p_data->strip_positions[mid] - mid <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return offset + lo;
+}
+
+// Range of the original input, in bytes (or UTF-16 code units), that a copy
+// made by copy_input_span() comes from. It is stored in front of the copy, so it
+// goes wherever the copy is passed (see input_span_of()):
+typedef struct
+{
+    unsigned long pos;
+    unsigned long end;
+} pmh_input_span;
+
+/* Write the `len` UTF-16 code units at `src` as UTF-8 to `out` (a lone
+   surrogate as U+FFFD), or only count the bytes if `out` is NULL. Return
+   their number. */
+static size_t utf16_to_utf8(const unsigned short *src, size_t len, char *out)
+{
+    size_t n = 0;
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        unsigned long c = src[i];
+        if (c >= 0xD800 && c <= 0xDFFF) {
+            if (c <= 0xDBFF && i + 1 < len
+                && src[i + 1] >= 0xDC00 && src[i + 1] <= 0xDFFF)
+            {
+                c = 0x10000 + ((c - 0xD800) << 10) + (src[i + 1] - 0xDC00);
+                i++;
+            }
+            else
+                c = 0xFFFD;
+        }
+        
+        if (c < 0x80) {
+            if (out != NULL)
+                out[n] = (char)c;
+            n += 1;
+        } else if (c < 0x800) {
+            if (out != NULL) {
+                out[n] = (char)(0xC0 | (c >> 6));
+                out[n + 1] = (char)(0x80 | (c & 0x3F));
+            }
+            n += 2;
+        } else if (c < 0x10000) {
+            if (out != NULL) {
+                out[n] = (char)(0xE0 | (c >> 12));
+                out[n + 1] = (char)(0x80 | ((c >> 6) & 0x3F));
+                out[n + 2] = (char)(0x80 | (c & 0x3F));
+            }
+            n += 3;
+        } else {
+            if (out != NULL) {
+                out[n] = (char)(0xF0 | (c >> 18));
+                out[n + 1] = (char)(0x80 | ((c >> 12) & 0x3F));
+                out[n + 2] = (char)(0x80 | ((c >> 6) & 0x3F));
+                out[n + 3] = (char)(0x80 | (c & 0x3F));
+            }
+            n += 4;
+        }
+    }
+    return n;
+}
+
 // Given a range in the list of spans we use for parsing (pos, end), return
 // a copy of the corresponding section in the original input, with all of
-// the UTF-8 bytes intact:
+// the UTF-8 bytes intact (UTF-16 input is copied as UTF-8):
 static char *copy_input_span(parser_data *p_data,
                              unsigned long pos, unsigned long end)
 {
     if (end <= pos)
         return NULL;
     
-    char *ret = NULL;
-    
     // Adjust (pos,end) to match actual indexes in charbuf:
     pmh_realelement *dummy = mk_element(p_data, pmh_NO_TYPE, pos, end);
     pmh_realelement *fixed_dummies = fix_offsets(p_data, dummy);
-    pmh_realelement *cursor = fixed_dummies;
-    while (cursor != NULL)
+    
+    // Adjust the spans to take bytes stripped from the original input into
+    // account (i.e. match the corresponding spans in p_data->original_input),
+    // and add up their lengths:
+    bool found = false;
+    size_t total_len = 0;
+    pmh_realelement *cursor;
+    for (cursor = fixed_dummies; cursor != NULL; cursor = cursor->next)
     {
+        // The "\n\n" suffix is not in the original input:
+        if (cursor->end > p_data->charbuf_len)
+            cursor->end = p_data->charbuf_len;
         if (cursor->end <= cursor->pos)
-        {
-            cursor = cursor->next;
             continue;
-        }
         
-        // Adjust cursor's span to take bytes stripped from the original
-        // input into account (i.e. match the corresponding span in
-        // p_data->original_input):
-        unsigned long adjusted_pos = cursor->pos;
-        unsigned long adjusted_end = cursor->end;
-        size_t i;
-        for (i = 0; i < p_data->strip_positions_len; i++)
-        {
-            unsigned long strip_position = p_data->strip_positions[i];
-            if (strip_position <= adjusted_pos)
-                adjusted_pos++;
-            if (strip_position <= adjusted_end)
-                adjusted_end++;
-            else
-                break;
-        }
-        
-        // Copy span from original input:
-        size_t adjusted_len = adjusted_end - adjusted_pos;
-        char *str = (char *)malloc(sizeof(char)*adjusted_len + 1);
-        *str = '\0';
-        strncat(str, (p_data->original_input + adjusted_pos), adjusted_len);
-        
-        if (ret == NULL)
-            ret = str;
+        cursor->pos = original_offset(p_data, cursor->pos);
+        cursor->end = original_offset(p_data, cursor->end);
+        if (p_data->original_utf16 != NULL)
+            total_len += utf16_to_utf8(p_data->original_utf16 + cursor->pos,
+                                       cursor->end - cursor->pos, NULL);
         else
-        {
-            // append str to ret:
-            char *new_ret = (char *)malloc(sizeof(char)
-                                           *(strlen(str) + strlen(ret)) + 1);
-            *new_ret = '\0';
-            strcat(new_ret, ret);
-            strcat(new_ret, str);
-            free(ret);
-            free(str);
-            ret = new_ret;
+            total_len += cursor->end - cursor->pos;
+        found = true;
+    }
+    if (!found)
+        return NULL;
+    
+    // Copy the spans from the original input:
+    pmh_input_span *span = (pmh_input_span *)
+        arena_alloc(p_data->arena, sizeof(pmh_input_span) + total_len + 1,
+                    p_data);
+    char *ret = (char *)(span + 1);
+    char *out = ret;
+    span->pos = ULONG_MAX;
+    for (cursor = fixed_dummies; cursor != NULL; cursor = cursor->next)
+    {
+        if (cursor->end <= cursor->pos)
+            continue;
+        if (span->pos == ULONG_MAX)
+            span->pos = cursor->pos;
+        span->end = cursor->end;
+        size_t len = cursor->end - cursor->pos;
+        if (p_data->original_utf16 != NULL) {
+            out += utf16_to_utf8(p_data->original_utf16 + cursor->pos, len,
+                                 out);
+        } else {
+            memcpy(out, p_data->original_input + cursor->pos, len);
+            out += len;
         }
-        
-        cursor = cursor->next;
     }
+    *out = '\0';
     
     return ret;
 }
 
+// Return the range of the original input that `copy`, made by
+// copy_input_span(), comes from. Text stripped from the input lies
+// within it, and so does the text between the spans of a copy made
+// from several, though addresses never span more than one line.
+static pmh_input_span *input_span_of(char *copy)
+{
+    return (pmh_input_span *)copy - 1;
+}
+
+
+
+/*
+Flat results (see pmh_flat_elements)
+
+The element lists are gathered and sorted, then copied into columns in a
+single block of memory: the arrays of unsigned longs first, then those of
+size_t, then those of bytes, so that each is aligned.
+*/
+
+// An element to sort, with its keys at hand:
+typedef struct
+{
+    unsigned long pos;
+    unsigned long end;
+    int type;
+    pmh_element *elem;
+} pmh_flat_key;
+
+static int flat_compare(const void *a, const void *b)
+{
+    const pmh_flat_key *x = (const pmh_flat_key *)a;
+    const pmh_flat_key *y = (const pmh_flat_key *)b;
+    if (x->pos != y->pos)
+        return (x->pos < y->pos) ? -1 : 1;
+    if (x->end != y->end)
+        return (x->end < y->end) ? -1 : 1;
+    return x->type - y->type;
+}
+
+static int range_compare(const void *a, const void *b)
+{
+    const pmh_range *x = *(const pmh_range * const *)a;
+    const pmh_range *y = *(const pmh_range * const *)b;
+    if (x->pos != y->pos)
+        return (x->pos < y->pos) ? -1 : 1;
+    return 0;
+}
+
+static pmh_flat_elements *flatten(pmh_element **elems, pmh_range *unparsed)
+{
+    size_t count = 0, ranges_count = 0;
+    int i;
+    pmh_element *e;
+    pmh_range *r;
+    for (i = 0; i < pmh_NUM_LANG_TYPES; i++)
+    {
+        for (e = elems[i]; e != NULL; e = e->next)
+            count++;
+    }
+    for (r = unparsed; r != NULL; r = r->next)
+        ranges_count++;
+    
+    pmh_flat_key *sorted = (pmh_flat_key *)
+        malloc(sizeof(pmh_flat_key) * (count + 1));
+    size_t n = 0;
+    for (i = 0; i < pmh_NUM_LANG_TYPES; i++)
+    {
+        for (e = elems[i]; e != NULL; e = e->next, n++) {
+            sorted[n].pos = e->pos;
+            sorted[n].end = e->end;
+            sorted[n].type = i;
+            sorted[n].elem = e;
+        }
+    }
+    qsort(sorted, count, sizeof(pmh_flat_key), flat_compare);
+    
+    pmh_range **ranges = (pmh_range **)
+        malloc(sizeof(pmh_range *) * (ranges_count + 1));
+    n = 0;
+    for (r = unparsed; r != NULL; r = r->next)
+        ranges[n++] = r;
+    qsort(ranges, ranges_count, sizeof(pmh_range *), range_compare);
+    
+    // Merge the unparsed ranges that overlap or touch:
+    size_t merged = 0;
+    for (n = 0; n < ranges_count; n++)
+    {
+        if (merged > 0 && ranges[n]->pos <= ranges[merged - 1]->end) {
+            if (ranges[n]->end > ranges[merged - 1]->end)
+                ranges[merged - 1]->end = ranges[n]->end;
+        } else {
+            ranges[merged++] = ranges[n];
+        }
+    }
+    ranges_count = merged;
+    
+    size_t bytes = sizeof(pmh_flat_elements)
+                   + sizeof(unsigned long) * (4 * count + 2 * ranges_count)
+                   + sizeof(size_t) * count
+                   + 2 * count;
+    pmh_flat_elements *flat = (pmh_flat_elements *)malloc(bytes);
+    unsigned long *longs = (unsigned long *)(flat + 1);
+    flat->count = count;
+    flat->pos = longs;
+    flat->end = flat->pos + count;
+    flat->address_pos = flat->end + count;
+    flat->address_end = flat->address_pos + count;
+    flat->unparsed_pos = flat->address_end + count;
+    flat->unparsed_end = flat->unparsed_pos + ranges_count;
+    flat->by_type = (size_t *)(flat->unparsed_end + ranges_count);
+    flat->types = (unsigned char *)(flat->by_type + count);
+    flat->flags = flat->types + count;
+    flat->unparsed_count = ranges_count;
+    flat->bytes = bytes;
+    
+    for (i = 0; i <= pmh_NUM_LANG_TYPES; i++)
+        flat->type_start[i] = 0;
+    for (n = 0; n < count; n++)
+    {
+        e = sorted[n].elem;
+        flat->types[n] = (unsigned char)sorted[n].type;
+        flat->pos[n] = e->pos;
+        flat->end[n] = e->end;
+        if (e->address != NULL) {
+            pmh_input_span *span = input_span_of(e->address);
+            flat->flags[n] = pmh_FLAT_ADDRESS;
+            flat->address_pos[n] = span->pos;
+            flat->address_end[n] = span->end;
+        } else {
+            flat->flags[n] = 0;
+            flat->address_pos[n] = flat->address_end[n] = 0;
+        }
+        flat->type_start[sorted[n].type + 1]++;
+    }
+    
+    // Group the indexes by type, keeping their order within each type:
+    for (i = 0; i < pmh_NUM_LANG_TYPES; i++)
+        flat->type_start[i + 1] += flat->type_start[i];
+    size_t next[pmh_NUM_LANG_TYPES];
+    for (i = 0; i < pmh_NUM_LANG_TYPES; i++)
+        next[i] = flat->type_start[i];
+    for (n = 0; n < count; n++)
+        flat->by_type[next[flat->types[n]]++] = n;
+    
+    for (n = 0; n < ranges_count; n++)
+    {
+        flat->unparsed_pos[n] = ranges[n]->pos;
+        flat->unparsed_end[n] = ranges[n]->end;
+    }
+    
+    free(ranges);
+    free(sorted);
+    return flat;
+}
+
+bool pmh_markdown_to_flat_elements(const char *data, size_t len,
+                                   int extensions, int num_threads,
+                                   const pmh_parse_budget *budget,
+                                   pmh_cancel_callback cancel,
+                                   void *cancel_context,
+                                   pmh_flat_elements **out_result)
+{
+    pmh_element **elems = NULL;
+    pmh_range *unparsed = NULL;
+    if (!pmh_markdown_buffer_to_elements(data, len, extensions, num_threads,
+                                         budget, cancel, cancel_context,
+                                         &elems, &unparsed))
+    {
+        *out_result = NULL;
+        return false;
+    }
+    
+    *out_result = flatten(elems, unparsed);
+    pmh_free_elements(elems);
+    return true;
+}
+
+bool pmh_markdown_utf16_to_flat_elements(const unsigned short *data,
+                                         size_t len,
+                                         int extensions, int num_threads,
+                                         const pmh_parse_budget *budget,
+                                         pmh_cancel_callback cancel,
+                                         void *cancel_context,
+                                         pmh_flat_elements **out_result)
+{
+    pmh_element **elems = NULL;
+    pmh_range *unparsed = NULL;
+    if (!pmh_markdown_utf16_to_elements(data, len, extensions, num_threads,
+                                        budget, cancel, cancel_context,
+                                        &elems, &unparsed))
+    {
+        *out_result = NULL;
+        return false;
+    }
+    
+    *out_result = flatten(elems, unparsed);
+    pmh_free_elements(elems);
+    return true;
+}
+
+void pmh_free_flat_elements(pmh_flat_elements *elems)
+{
+    free(elems);
+}
+
 
 
 
@@ -957,11 +2967,21 @@ static char *copy_input_span(parser_data *p_data,
 static void yy_input_func(char *buf, int *result, int max_size,
                           parser_data *p_data)
 {
+    // A cancelled parse sees the end of input, which makes it finish fast;
+    // so does one out of budget, see out_of_budget(). Past the last span
+    // the end of input stays where it is, which memoized() relies on, and
+    // needs no counting.
     if (p_data->current_elem == NULL)
     {
         (*result) = 0;
         return;
     }
+    if (p_data->budget->exhausted || is_cancelled(p_data, false))
+    {
+        (*result) = 0;
+        p_data->input_ends++;
+        return;
+    }
     
     if (p_data->current_elem->type == pmh_EXTRA_TEXT)
     {
@@ -984,15 +3004,65 @@ static void yy_input_func(char *buf, int *result, int max_size,
                 p_data->offset = p_data->current_elem->pos;
         }
         (*result) = (EOF == yyc) ? 0 : (*(buf) = yyc, 1);
+        if (EOF == yyc)
+            p_data->input_ends++;
         return;
     }
     
-    *(buf) = *(p_data->charbuf + p_data->offset);
-    (*result) = (*buf != '\0');
-    p_data->offset++;
+    // Copy the rest of the pmh_RAW span at once, as far as it fits. Past
+    // the text in charbuf comes its "\n\n" suffix:
+    static const char suffix[] = "\n\n";
+    const char *src;
+    long len = (long)p_data->current_elem->end - (long)p_data->offset;
+    if (p_data->offset < p_data->charbuf_len) {
+        src = p_data->charbuf + p_data->offset;
+        if (len > (long)(p_data->charbuf_len - p_data->offset))
+            len = (long)(p_data->charbuf_len - p_data->offset);
+    } else {
+        unsigned long suffix_pos = p_data->offset - p_data->charbuf_len;
+        if (suffix_pos > 2)
+            suffix_pos = 2;
+        src = suffix + suffix_pos;
+        if (len > (long)(2 - suffix_pos))
+            len = (long)(2 - suffix_pos);
+    }
+    if (len > max_size)
+        len = max_size;
+    if (len < 1)
+        len = 1;
+    
+    // Hand out no more than is left until the next poll of the
+    // cancellation callback, which is_cancelled() has counted one of
+    pmh_cancellation *cancellation = p_data->cancellation;
+    if (cancellation != NULL) {
+        if (len > cancellation->countdown + 1)
+            len = cancellation->countdown + 1;
+        cancellation->countdown -= len - 1;
+    }
+    
+    // The end of the suffix reads as the end of input; only a span after
+    // this one would make it read on
+    const char *nul = (const char *)memchr(src, '\0', len);
+    if (nul == src) {
+        (*result) = 0;
+        if (p_data->current_elem->next != NULL)
+            p_data->input_ends++;
+        len = 1;
+    } else {
+        if (nul != NULL)
+            len = nul - src;
+        memcpy(buf, src, len);
+        (*result) = len;
+    }
+    p_data->offset += len;
     
-    pmh_PRINTF("\e[43;30m"); pmh_PUTCHAR(*buf); pmh_PRINTF("\e[0m");
-    pmh_IF(*buf == '\n') pmh_PRINTF("\e[42m \e[0m");
+    #if pmh_DEBUG_OUTPUT
+    long i;
+    for (i = 0; i < (*result); i++) {
+        pmh_PRINTF("\e[43;30m"); pmh_PUTCHAR(buf[i]); pmh_PRINTF("\e[0m");
+        pmh_IF(buf[i] == '\n') pmh_PRINTF("\e[42m \e[0m");
+    }
+    #endif
     
     if (p_data->offset >= p_data->current_elem->end)
     {
@@ -1015,25 +3085,19 @@ static void yy_input_func(char *buf, int *result, int max_size,
 #define REF_EXISTS(x) reference_exists((parser_data *)G->data, x)
 #define GET_REF(x)  get_reference((parser_data *)G->data, x)
 #define PARSING_REFERENCES ((parser_data *)G->data)->parsing_only_references
-#define FREE_LABEL(l) { free(l->label); l->label = NULL; }
-#define FREE_ADDRESS(l) { free(l->address); l->address = NULL; }
+#define FREE_LABEL(l) { l->label = NULL; }
+#define FREE_ADDRESS(l) { l->address = NULL; }
 
 // This gives us the text matched with < > as it appears in the original input:
 #define COPY_YYTEXT_ORIG() copy_input_span((parser_data *)G->data, thunk->begin, thunk->end)
 
 
-#ifndef YY_ALLOC
-#define YY_ALLOC(N, D) malloc(N)
-#endif
 #ifndef YY_CALLOC
 #define YY_CALLOC(N, S, D) calloc(N, S)
 #endif
 #ifndef YY_REALLOC
 #define YY_REALLOC(B, N, D) realloc(B, N)
 #endif
-#ifndef YY_FREE
-#define YY_FREE free
-#endif
 #ifndef YY_LOCAL
 #define YY_LOCAL(T)     static T
 #endif
@@ -1193,6 +3257,9 @@ YY_LOCAL(void) yyDo(GREG *G, yyaction action, int begin, int end)
   ++G->thunkpos;
 }
 
+/* greg sets yytext before each predicate, too; none of the predicates in
+   the rules below read it, so that is left out. It copied the text from
+   G->begin on, which in nested brackets is the whole of them, each time. */
 YY_LOCAL(int) yyText(GREG *G, int begin, int end)
 {
   int yyleng= end - begin;
@@ -1251,7 +3318,16 @@ YY_LOCAL(int) yyAccept(GREG *G, int tp0)
   return 1;
 }
 
-YY_LOCAL(void) yyPush(GREG *G, char *text, int count, yythunk *thunk, YY_XTYPE YY_XVAR) { G->val += count; }
+YY_LOCAL(void) yyPush(GREG *G, char *text, int count, yythunk *thunk, YY_XTYPE YY_XVAR)
+{
+  int yyoffset= (G->val - G->vals) + count;
+  while (yyoffset >= G->valslen)
+    {
+      G->valslen *= 2;
+      G->vals= (YYSTYPE *)YY_REALLOC(G->vals, sizeof(YYSTYPE) * G->valslen, G->data);
+    }
+  G->val= G->vals + yyoffset;
+}
 YY_LOCAL(void) yyPop(GREG *G, char *text, int count, yythunk *thunk, YY_XTYPE YY_XVAR)  { G->val -= count; }
 YY_LOCAL(void) yySet(GREG *G, char *text, int count, yythunk *thunk, YY_XTYPE YY_XVAR)  { G->val[count]= G->ss; }
 
@@ -1485,6 +3561,373 @@ YY_RULE(int) yy_LocMarker(GREG *G); /* 3 */
 YY_RULE(int) yy_Block(GREG *G); /* 2 */
 YY_RULE(int) yy_Doc(GREG *G); /* 1 */
 
+YY_RULE(int) yy_Label_unmemoized(GREG *G);
+static bool memo_label_failed(GREG *G, int failed_from,
+                              unsigned long input_ends);
+YY_RULE(int) yy_Code_unmemoized(GREG *G);
+YY_RULE(int) yy_Link_unmemoized(GREG *G);
+YY_RULE(int) yy_Emph_unmemoized(GREG *G);
+YY_RULE(int) yy_Strong_unmemoized(GREG *G);
+YY_RULE(int) yy_Block_unbudgeted(GREG *G);
+YY_RULE(int) yy_References_unbudgeted(GREG *G);
+
+
+/*
+Count a step of the parse with take_step(). Once the budget is exhausted,
+the parser would still follow the text in the loops of the rules it is
+in, in each of them, which may take as long as the parse would have. So
+the input is stopped: the parser sees its end at every position, and
+fails its way up fast. restore_input() undoes this before greg commits
+the input.
+*/
+static bool out_of_budget(GREG *G)
+{
+    parser_data *p_data = (parser_data *)G->data;
+    if (take_step(p_data))
+        return false;
+    if (!p_data->input_stopped) {
+        p_data->stopped_limit = G->limit;
+        p_data->input_stopped = true;
+        G->limit = 0;
+    }
+    return true;
+}
+
+static void restore_input(GREG *G)
+{
+    parser_data *p_data = (parser_data *)G->data;
+    if (p_data->input_stopped) {
+        G->limit = p_data->stopped_limit;
+        p_data->input_stopped = false;
+    }
+}
+
+
+/*
+Packrat memoization (opt-in with pmh_EXT_MEMOIZE)
+
+Unclosed brackets and emphasis markers make the rules for links and
+emphasis try the same text again and again, which takes exponential time.
+memoized() records the outcome of such a rule at a position: whether it
+matched, where it ended, G->begin and G->end, and the thunks it pushed.
+Trying the rule there again replays that.
+
+Only the markers that open emphasis, links and code spans lead to such
+repetition, so the rules are memoized at those characters only; elsewhere
+they fail fast anyway.
+
+The outcome only depends on the text read, unless the input reported its
+end on the way: after a pmh_EXTRA_TEXT span it does that once and then
+goes on with the next span. Such outcomes are not recorded, nor those
+after the budget of the parse ran out. The end of the last span stays
+where it is, so outcomes that ran into it are.
+
+A run of unclosed brackets, "[a [a [a ...", still takes quadratic time
+that way: each Label fails only at the end of the paragraph, and the one
+around it reads on past the inner '[' as a plain symbol, over the same
+text again. But the loop of Label, (!']' Inline)*, goes on the same from
+wherever it is, so once it failed from a position, any other Label that
+comes by there fails too. memo_label_failed() records such positions and
+looks them up (as pmh_MEMO_LABEL_TAIL), which reads each '[' once.
+
+Outcomes of nested rules would copy the thunks of the inner ones again,
+so successes with more than pmh_MEMO_MAX_THUNKS thunks are not recorded;
+running them again is cheap once their inner rules are. In total, the
+memory used is bounded by pmh_MEMO_BUDGET; beyond it nothing more is
+recorded and the rules run as without memoization.
+*/
+
+#ifndef pmh_MEMO_BUDGET
+#define pmh_MEMO_BUDGET (16 * 1024 * 1024)
+#endif
+#define pmh_MEMO_MAX_THUNKS 256
+
+enum pmh_memo_rule
+{
+    pmh_MEMO_LABEL = 1,
+    pmh_MEMO_CODE,
+    pmh_MEMO_LINK,
+    pmh_MEMO_EMPH,
+    pmh_MEMO_STRONG,
+    pmh_MEMO_LABEL_TAIL
+};
+
+typedef struct
+{
+    unsigned int generation; /* free unless that of the memo */
+    int rule;
+    int pos;
+    bool ok;
+    int end_pos, begin, end;
+    size_t thunks_start, thunks_len;
+} pmh_memo_entry;
+
+typedef struct pmh_Memo
+{
+    pmh_memo_entry *entries;  /* hash table, open addressing */
+    size_t num_entries;       /* a power of two */
+    size_t used;
+    unsigned int generation;  /* of the entries in use */
+    yythunk *thunks;          /* of all entries */
+    size_t thunks_len, thunks_size;
+    size_t bytes;
+} pmh_memo;
+
+#define pmh_MEMO_INITIAL_ENTRIES 1024
+
+/* The memo outlives parser runs, so it is allocated without parser data */
+static pmh_memo *mk_memo(void)
+{
+    pmh_memo *memo = (pmh_memo *)YY_ALLOC(sizeof(pmh_memo), NULL);
+    memo->num_entries = pmh_MEMO_INITIAL_ENTRIES;
+    memo->entries = (pmh_memo_entry *)
+        YY_ALLOC(sizeof(pmh_memo_entry) * memo->num_entries, NULL);
+    memset(memo->entries, 0, sizeof(pmh_memo_entry) * memo->num_entries);
+    memo->used = 0;
+    memo->generation = 1;
+    memo->thunks = NULL;
+    memo->thunks_len = memo->thunks_size = 0;
+    memo->bytes = sizeof(pmh_memo) + sizeof(pmh_memo_entry) * memo->num_entries;
+    return memo;
+}
+
+static void free_memo(pmh_memo *memo)
+{
+    YY_FREE(memo->entries);
+    YY_FREE(memo->thunks);
+    YY_FREE(memo);
+}
+
+/* Forget all entries, for the next parser run; the memory is kept */
+static void reset_memo(pmh_memo *memo)
+{
+    memo->used = 0;
+    memo->thunks_len = 0;
+    if (++memo->generation == 0) {
+        memset(memo->entries, 0, sizeof(pmh_memo_entry) * memo->num_entries);
+        memo->generation = 1;
+    }
+}
+
+static size_t memo_slot(pmh_memo_entry *entries, size_t num_entries,
+                        unsigned int generation, int rule, int pos)
+{
+    unsigned int h = (unsigned int)pos * 8 + rule;
+    h = ((h >> 16) ^ h) * 0x45d9f3bu;
+    h = ((h >> 16) ^ h) * 0x45d9f3bu;
+    h = (h >> 16) ^ h;
+    size_t i = h & (num_entries - 1);
+    while (entries[i].generation == generation
+           && (entries[i].rule != rule || entries[i].pos != pos))
+        i = (i + 1) & (num_entries - 1);
+    return i;
+}
+
+/* Make room for one more entry; false if that would exceed the budget */
+static bool memo_reserve_entry(pmh_memo *memo)
+{
+    if ((memo->used + 1) * 2 <= memo->num_entries)
+        return true;
+    
+    size_t num_entries = memo->num_entries * 2;
+    size_t bytes = memo->bytes + sizeof(pmh_memo_entry) * memo->num_entries;
+    if (bytes > pmh_MEMO_BUDGET)
+        return false;
+    
+    pmh_memo_entry *entries = (pmh_memo_entry *)
+        YY_ALLOC(sizeof(pmh_memo_entry) * num_entries, NULL);
+    memset(entries, 0, sizeof(pmh_memo_entry) * num_entries);
+    size_t i;
+    for (i = 0; i < memo->num_entries; i++) {
+        pmh_memo_entry *e = &memo->entries[i];
+        if (e->generation == memo->generation)
+            entries[memo_slot(entries, num_entries, memo->generation,
+                              e->rule, e->pos)] = *e;
+    }
+    YY_FREE(memo->entries);
+    memo->entries = entries;
+    memo->num_entries = num_entries;
+    memo->bytes = bytes;
+    return true;
+}
+
+/* Make room for `len` more thunks; false if that would exceed the budget */
+static bool memo_reserve_thunks(pmh_memo *memo, size_t len)
+{
+    if (memo->thunks_len + len <= memo->thunks_size)
+        return true;
+    
+    size_t size = (memo->thunks_size == 0) ? 1024 : memo->thunks_size;
+    while (size < memo->thunks_len + len)
+        size *= 2;
+    size_t bytes = memo->bytes + sizeof(yythunk) * (size - memo->thunks_size);
+    if (bytes > pmh_MEMO_BUDGET)
+        return false;
+    
+    memo->thunks = (yythunk *)YY_REALLOC(memo->thunks, sizeof(yythunk) * size,
+                                         NULL);
+    memo->thunks_size = size;
+    memo->bytes = bytes;
+    return true;
+}
+
+static int memoized(GREG *G, int rule, int (*parse_rule)(GREG *G))
+{
+    parser_data *p_data = (parser_data *)G->data;
+    if (out_of_budget(G))
+        return 0;
+    pmh_memo *memo = p_data->memo;
+    if (memo == NULL)
+        return parse_rule(G);
+    if (G->pos < G->limit && strchr("*_[`", G->buf[G->pos]) == NULL)
+        return parse_rule(G);
+    
+    int pos = G->pos;
+    size_t slot = memo_slot(memo->entries, memo->num_entries,
+                            memo->generation, rule, pos);
+    pmh_memo_entry *entry = &memo->entries[slot];
+    if (entry->generation == memo->generation)
+    {
+        if (entry->ok)
+        {
+            while (G->thunkpos + (int)entry->thunks_len >= G->thunkslen) {
+                G->thunkslen *= 2;
+                G->thunks = (yythunk *)YY_REALLOC(G->thunks,
+                                                  sizeof(yythunk) * G->thunkslen,
+                                                  G->data);
+            }
+            memcpy(G->thunks + G->thunkpos, memo->thunks + entry->thunks_start,
+                   sizeof(yythunk) * entry->thunks_len);
+            G->thunkpos += entry->thunks_len;
+            G->pos = entry->end_pos;
+        }
+        G->begin = entry->begin;
+        G->end = entry->end;
+        return entry->ok;
+    }
+    
+    int thunkpos = G->thunkpos;
+    unsigned long input_ends = p_data->input_ends;
+    int ok = parse_rule(G);
+    if (p_data->input_ends != input_ends || p_data->budget->exhausted)
+        return ok;
+    
+    size_t thunks_len = ok ? G->thunkpos - thunkpos : 0;
+    if (thunks_len > pmh_MEMO_MAX_THUNKS)
+        return ok;
+    if (!memo_reserve_entry(memo)
+        || !memo_reserve_thunks(memo, thunks_len))
+        return ok;
+    
+    slot = memo_slot(memo->entries, memo->num_entries, memo->generation,
+                     rule, pos);
+    entry = &memo->entries[slot];
+    entry->generation = memo->generation;
+    entry->rule = rule;
+    entry->pos = pos;
+    entry->ok = ok;
+    entry->end_pos = G->pos;
+    entry->begin = G->begin;
+    entry->end = G->end;
+    entry->thunks_start = memo->thunks_len;
+    entry->thunks_len = thunks_len;
+    if (thunks_len > 0)
+        memcpy(memo->thunks + memo->thunks_len, G->thunks + thunkpos,
+               sizeof(yythunk) * thunks_len);
+    memo->thunks_len += thunks_len;
+    memo->used++;
+    return ok;
+}
+
+/* The loop of a Label starts right after its '['. With `failed_from` set,
+record that the loop failed from there (if nothing in between stops the
+outcome from being recorded, see memoized()); otherwise tell whether a
+loop has failed from the current position before. */
+static bool memo_label_failed(GREG *G, int failed_from,
+                              unsigned long input_ends)
+{
+    parser_data *p_data = (parser_data *)G->data;
+    pmh_memo *memo = p_data->memo;
+    int pos = (failed_from >= 0) ? failed_from : G->pos;
+    if (memo == NULL || pos == 0 || G->buf[pos - 1] != '[')
+        return false;
+    
+    size_t slot = memo_slot(memo->entries, memo->num_entries,
+                            memo->generation, pmh_MEMO_LABEL_TAIL, pos);
+    pmh_memo_entry *entry = &memo->entries[slot];
+    if (entry->generation == memo->generation)
+        return true;
+    if (failed_from < 0 || p_data->input_ends != input_ends
+        || p_data->budget->exhausted || !memo_reserve_entry(memo))
+        return false;
+    
+    slot = memo_slot(memo->entries, memo->num_entries, memo->generation,
+                     pmh_MEMO_LABEL_TAIL, pos);
+    entry = &memo->entries[slot];
+    memset(entry, 0, sizeof(pmh_memo_entry));
+    entry->generation = memo->generation;
+    entry->rule = pmh_MEMO_LABEL_TAIL;
+    entry->pos = pos;
+    memo->used++;
+    return true;
+}
+
+YY_RULE(int) yy_Label(GREG *G)
+{
+    return memoized(G, pmh_MEMO_LABEL, yy_Label_unmemoized);
+}
+
+YY_RULE(int) yy_Code(GREG *G)
+{
+    return memoized(G, pmh_MEMO_CODE, yy_Code_unmemoized);
+}
+
+YY_RULE(int) yy_Link(GREG *G)
+{
+    return memoized(G, pmh_MEMO_LINK, yy_Link_unmemoized);
+}
+
+YY_RULE(int) yy_Emph(GREG *G)
+{
+    return memoized(G, pmh_MEMO_EMPH, yy_Emph_unmemoized);
+}
+
+YY_RULE(int) yy_Strong(GREG *G)
+{
+    return memoized(G, pmh_MEMO_STRONG, yy_Strong_unmemoized);
+}
+
+
+/*
+Budget of a parse (see out_of_budget())
+
+Once the budget is exhausted, the parser fails its way up to the block it
+is in. That block is dropped with its thunks, and Doc ends there; blocks
+matched before have all their thunks. The text of the dropped block and
+all behind it are recorded as unparsed.
+*/
+YY_RULE(int) yy_Block(GREG *G)
+{
+    parser_data *p_data = (parser_data *)G->data;
+    int pos = G->pos, thunkpos = G->thunkpos;
+    int ok = !out_of_budget(G) && yy_Block_unbudgeted(G);
+    if (!p_data->budget->exhausted)
+        return ok;
+    
+    restore_input(G);
+    G->pos = pos;
+    G->thunkpos = thunkpos;
+    add_unparsed_from(p_data, pos);
+    return 0;
+}
+
+YY_RULE(int) yy_References(GREG *G)
+{
+    int ok = yy_References_unbudgeted(G);
+    restore_input(G);
+    return ok;
+}
+
 YY_ACTION(void) yy_1_RawLine(GREG *G, char *yytext, int yyleng, yythunk *thunk, YY_XTYPE YY_XVAR)
 {
   yyprintf((stderr, "do yy_1_RawLine\n"));
@@ -1577,8 +4020,8 @@ YY_ACTION(void) yy_1_Reference(GREG *G, char *yytext, int yyleng, yythunk *thunk
   yyprintf((stderr, "do yy_1_Reference\n"));
   
                 pmh_realelement *el = elem_s(pmh_REFERENCE);
-                el->label = strdup_or_null(l->label);
-                el->address = strdup_or_null(r->address);
+                el->label = l->label;
+                el->address = r->address;
                 ADD(el);
                 FREE_LABEL(l);
                 FREE_ADDRESS(r);
@@ -1658,7 +4101,7 @@ YY_ACTION(void) yy_1_ExplicitLink(GREG *G, char *yytext, int yyleng, yythunk *th
   
                     yy = elem_s(pmh_LINK);
                     if (l->address != NULL)
-                        yy->address = strdup_or_null(l->address);
+                        yy->address = l->address;
                     FREE_LABEL(s);
                     FREE_ADDRESS(l);
                 ;
@@ -1673,8 +4116,8 @@ YY_ACTION(void) yy_1_ReferenceLinkSingle(GREG *G, char *yytext, int yyleng, yyth
                         	pmh_realelement *reference = GET_REF(s->label);
                             if (reference) {
                                 yy = elem_s(pmh_LINK);
-                                yy->label = strdup_or_null(s->label);
-                                yy->address = strdup_or_null(reference->address);
+                                yy->label = s->label;
+                                yy->address = reference->address;
                             } else
                                 yy = NULL;
                             FREE_LABEL(s);
@@ -1690,8 +4133,8 @@ YY_ACTION(void) yy_1_ReferenceLinkDouble(GREG *G, char *yytext, int yyleng, yyth
                         	pmh_realelement *reference = GET_REF(l->label);
                             if (reference) {
                                 yy = elem_s(pmh_LINK);
-                                yy->label = strdup_or_null(l->label);
-                                yy->address = strdup_or_null(reference->address);
+                                yy->label = l->label;
+                                yy->address = reference->address;
                             } else
                                 yy = NULL;
                             FREE_LABEL(s);
@@ -2104,7 +4547,7 @@ YY_RULE(int) yy_RawNoteReference(GREG *G)
 }
 YY_RULE(int) yy_ExtendedSpecialChar(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "ExtendedSpecialChar"));  yyText(G, G->begin, G->end);  if (!( EXT(pmh_EXT_NOTES) )) goto l15;  if (!yymatchChar(G, '^')) goto l15;
+  yyprintf((stderr, "%s\n", "ExtendedSpecialChar"));  if (!( EXT(pmh_EXT_NOTES) )) goto l15;  if (!yymatchChar(G, '^')) goto l15;
   yyprintf((stderr, "  ok   %s @ %s\n", "ExtendedSpecialChar", G->buf+G->pos));
   return 1;
   l15:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -2174,7 +4617,7 @@ YY_RULE(int) yy_HtmlTag(GREG *G)
 }
 YY_RULE(int) yy_Ticks5(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "Ticks5"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l35;  if (!yymatchString(G, "`````")) goto l35;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l35;
+  yyprintf((stderr, "%s\n", "Ticks5"));  if (!(YY_BEGIN)) goto l35;  if (!yymatchString(G, "`````")) goto l35;  if (!(YY_END)) goto l35;
   {  int yypos36= G->pos, yythunkpos36= G->thunkpos;  if (!yymatchChar(G, '`')) goto l36;  goto l35;
   l36:;	  G->pos= yypos36; G->thunkpos= yythunkpos36;
   }  yyDo(G, yy_1_Ticks5, G->begin, G->end);
@@ -2186,7 +4629,7 @@ YY_RULE(int) yy_Ticks5(GREG *G)
 }
 YY_RULE(int) yy_Ticks4(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "Ticks4"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l37;  if (!yymatchString(G, "````")) goto l37;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l37;
+  yyprintf((stderr, "%s\n", "Ticks4"));  if (!(YY_BEGIN)) goto l37;  if (!yymatchString(G, "````")) goto l37;  if (!(YY_END)) goto l37;
   {  int yypos38= G->pos, yythunkpos38= G->thunkpos;  if (!yymatchChar(G, '`')) goto l38;  goto l37;
   l38:;	  G->pos= yypos38; G->thunkpos= yythunkpos38;
   }  yyDo(G, yy_1_Ticks4, G->begin, G->end);
@@ -2198,7 +4641,7 @@ YY_RULE(int) yy_Ticks4(GREG *G)
 }
 YY_RULE(int) yy_Ticks3(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "Ticks3"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l39;  if (!yymatchString(G, "```")) goto l39;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l39;
+  yyprintf((stderr, "%s\n", "Ticks3"));  if (!(YY_BEGIN)) goto l39;  if (!yymatchString(G, "```")) goto l39;  if (!(YY_END)) goto l39;
   {  int yypos40= G->pos, yythunkpos40= G->thunkpos;  if (!yymatchChar(G, '`')) goto l40;  goto l39;
   l40:;	  G->pos= yypos40; G->thunkpos= yythunkpos40;
   }  yyDo(G, yy_1_Ticks3, G->begin, G->end);
@@ -2210,7 +4653,7 @@ YY_RULE(int) yy_Ticks3(GREG *G)
 }
 YY_RULE(int) yy_Ticks2(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "Ticks2"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l41;  if (!yymatchString(G, "``")) goto l41;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l41;
+  yyprintf((stderr, "%s\n", "Ticks2"));  if (!(YY_BEGIN)) goto l41;  if (!yymatchString(G, "``")) goto l41;  if (!(YY_END)) goto l41;
   {  int yypos42= G->pos, yythunkpos42= G->thunkpos;  if (!yymatchChar(G, '`')) goto l42;  goto l41;
   l42:;	  G->pos= yypos42; G->thunkpos= yythunkpos42;
   }  yyDo(G, yy_1_Ticks2, G->begin, G->end);
@@ -2222,7 +4665,7 @@ YY_RULE(int) yy_Ticks2(GREG *G)
 }
 YY_RULE(int) yy_Ticks1(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "Ticks1"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l43;  if (!yymatchChar(G, '`')) goto l43;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l43;
+  yyprintf((stderr, "%s\n", "Ticks1"));  if (!(YY_BEGIN)) goto l43;  if (!yymatchChar(G, '`')) goto l43;  if (!(YY_END)) goto l43;
   {  int yypos44= G->pos, yythunkpos44= G->thunkpos;  if (!yymatchChar(G, '`')) goto l44;  goto l43;
   l44:;	  G->pos= yypos44; G->thunkpos= yythunkpos44;
   }  yyDo(G, yy_1_Ticks1, G->begin, G->end);
@@ -2263,7 +4706,7 @@ YY_RULE(int) yy_SkipBlock(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "SkipBlock", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_References(GREG *G)
+YY_RULE(int) yy_References_unbudgeted(GREG *G)
 {
   yyprintf((stderr, "%s\n", "References"));
   l57:;	
@@ -2363,11 +4806,11 @@ YY_RULE(int) yy_RefTitle(GREG *G)
 }
 YY_RULE(int) yy_RefSrc(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "RefSrc"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l85;  if (!yy_Nonspacechar(G)) { goto l85; }
+  yyprintf((stderr, "%s\n", "RefSrc"));  if (!(YY_BEGIN)) goto l85;  if (!yy_Nonspacechar(G)) { goto l85; }
   l86:;	
   {  int yypos87= G->pos, yythunkpos87= G->thunkpos;  if (!yy_Nonspacechar(G)) { goto l87; }  goto l86;
   l87:;	  G->pos= yypos87; G->thunkpos= yythunkpos87;
-  }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l85;  yyDo(G, yy_1_RefSrc, G->begin, G->end);
+  }  if (!(YY_END)) goto l85;  yyDo(G, yy_1_RefSrc, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "RefSrc", G->buf+G->pos));
   return 1;
   l85:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -2376,11 +4819,11 @@ YY_RULE(int) yy_RefSrc(GREG *G)
 }
 YY_RULE(int) yy_AutoLinkEmail(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "AutoLinkEmail"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l88;  if (!yy_LocMarker(G)) { goto l88; }  yyDo(G, yySet, -1, 0);  yyDo(G, yy_1_AutoLinkEmail, G->begin, G->end);  if (!yymatchChar(G, '<')) goto l88;
+  yyprintf((stderr, "%s\n", "AutoLinkEmail"));  if (!(YY_BEGIN)) goto l88;  if (!yy_LocMarker(G)) { goto l88; }  yyDo(G, yySet, -1, 0);  yyDo(G, yy_1_AutoLinkEmail, G->begin, G->end);  if (!yymatchChar(G, '<')) goto l88;
   {  int yypos89= G->pos, yythunkpos89= G->thunkpos;  if (!yymatchString(G, "mailto:")) goto l89;  goto l90;
   l89:;	  G->pos= yypos89; G->thunkpos= yythunkpos89;
   }
-  l90:;	  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l88;  if (!yymatchClass(G, (unsigned char *)"\000\000\000\000\062\350\377\003\376\377\377\207\376\377\377\107\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l88;
+  l90:;	  if (!(YY_BEGIN)) goto l88;  if (!yymatchClass(G, (unsigned char *)"\000\000\000\000\062\350\377\003\376\377\377\207\376\377\377\107\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l88;
   l91:;	
   {  int yypos92= G->pos, yythunkpos92= G->thunkpos;  if (!yymatchClass(G, (unsigned char *)"\000\000\000\000\062\350\377\003\376\377\377\207\376\377\377\107\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l92;  goto l91;
   l92:;	  G->pos= yypos92; G->thunkpos= yythunkpos92;
@@ -2400,7 +4843,7 @@ YY_RULE(int) yy_AutoLinkEmail(GREG *G)
   l98:;	  G->pos= yypos98; G->thunkpos= yythunkpos98;
   }  if (!yymatchDot(G)) goto l94;  goto l93;
   l94:;	  G->pos= yypos94; G->thunkpos= yythunkpos94;
-  }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l88;  yyDo(G, yy_2_AutoLinkEmail, G->begin, G->end);  if (!yymatchChar(G, '>')) goto l88;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l88;  yyDo(G, yy_3_AutoLinkEmail, G->begin, G->end);
+  }  if (!(YY_END)) goto l88;  yyDo(G, yy_2_AutoLinkEmail, G->begin, G->end);  if (!yymatchChar(G, '>')) goto l88;  if (!(YY_END)) goto l88;  yyDo(G, yy_3_AutoLinkEmail, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "AutoLinkEmail", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l88:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -2409,7 +4852,7 @@ YY_RULE(int) yy_AutoLinkEmail(GREG *G)
 }
 YY_RULE(int) yy_AutoLinkUrl(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "AutoLinkUrl"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l99;  if (!yy_LocMarker(G)) { goto l99; }  yyDo(G, yySet, -1, 0);  yyDo(G, yy_1_AutoLinkUrl, G->begin, G->end);  if (!yymatchChar(G, '<')) goto l99;  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l99;  if (!yymatchClass(G, (unsigned char *)"\000\000\000\000\000\000\000\000\376\377\377\007\376\377\377\007\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l99;
+  yyprintf((stderr, "%s\n", "AutoLinkUrl"));  if (!(YY_BEGIN)) goto l99;  if (!yy_LocMarker(G)) { goto l99; }  yyDo(G, yySet, -1, 0);  yyDo(G, yy_1_AutoLinkUrl, G->begin, G->end);  if (!yymatchChar(G, '<')) goto l99;  if (!(YY_BEGIN)) goto l99;  if (!yymatchClass(G, (unsigned char *)"\000\000\000\000\000\000\000\000\376\377\377\007\376\377\377\007\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l99;
   l100:;	
   {  int yypos101= G->pos, yythunkpos101= G->thunkpos;  if (!yymatchClass(G, (unsigned char *)"\000\000\000\000\000\000\000\000\376\377\377\007\376\377\377\007\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l101;  goto l100;
   l101:;	  G->pos= yypos101; G->thunkpos= yythunkpos101;
@@ -2429,7 +4872,7 @@ YY_RULE(int) yy_AutoLinkUrl(GREG *G)
   l107:;	  G->pos= yypos107; G->thunkpos= yythunkpos107;
   }  if (!yymatchDot(G)) goto l103;  goto l102;
   l103:;	  G->pos= yypos103; G->thunkpos= yythunkpos103;
-  }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l99;  yyDo(G, yy_2_AutoLinkUrl, G->begin, G->end);  if (!yymatchChar(G, '>')) goto l99;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l99;  yyDo(G, yy_3_AutoLinkUrl, G->begin, G->end);
+  }  if (!(YY_END)) goto l99;  yyDo(G, yy_2_AutoLinkUrl, G->begin, G->end);  if (!yymatchChar(G, '>')) goto l99;  if (!(YY_END)) goto l99;  yyDo(G, yy_3_AutoLinkUrl, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "AutoLinkUrl", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l99:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -2544,8 +4987,8 @@ YY_RULE(int) yy_Title(GREG *G)
 YY_RULE(int) yy_Source(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "Source"));  yyDo(G, yy_1_Source, G->begin, G->end);
-  {  int yypos141= G->pos, yythunkpos141= G->thunkpos;  if (!yymatchChar(G, '<')) goto l142;  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l142;  if (!yy_SourceContents(G)) { goto l142; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l142;  yyDo(G, yy_2_Source, G->begin, G->end);  if (!yymatchChar(G, '>')) goto l142;  goto l141;
-  l142:;	  G->pos= yypos141; G->thunkpos= yythunkpos141;  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l140;  if (!yy_SourceContents(G)) { goto l140; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l140;  yyDo(G, yy_3_Source, G->begin, G->end);
+  {  int yypos141= G->pos, yythunkpos141= G->thunkpos;  if (!yymatchChar(G, '<')) goto l142;  if (!(YY_BEGIN)) goto l142;  if (!yy_SourceContents(G)) { goto l142; }  if (!(YY_END)) goto l142;  yyDo(G, yy_2_Source, G->begin, G->end);  if (!yymatchChar(G, '>')) goto l142;  goto l141;
+  l142:;	  G->pos= yypos141; G->thunkpos= yythunkpos141;  if (!(YY_BEGIN)) goto l140;  if (!yy_SourceContents(G)) { goto l140; }  if (!(YY_END)) goto l140;  yyDo(G, yy_3_Source, G->begin, G->end);
   }
   l141:;	
   yyprintf((stderr, "  ok   %s @ %s\n", "Source", G->buf+G->pos));
@@ -2554,38 +4997,40 @@ YY_RULE(int) yy_Source(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "Source", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_Label(GREG *G)
+YY_RULE(int) yy_Label_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "Label"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l143;  if (!yy_LocMarker(G)) { goto l143; }  yyDo(G, yySet, -1, 0);  if (!yymatchChar(G, '[')) goto l143;
+  int yytail= -1;  unsigned long yyends= ((parser_data *)G->data)->input_ends;
+  yyprintf((stderr, "%s\n", "Label"));  if (!(YY_BEGIN)) goto l143;  if (!yy_LocMarker(G)) { goto l143; }  yyDo(G, yySet, -1, 0);  if (!yymatchChar(G, '[')) goto l143;
   {  int yypos144= G->pos, yythunkpos144= G->thunkpos;
   {  int yypos146= G->pos, yythunkpos146= G->thunkpos;  if (!yymatchChar(G, '^')) goto l146;  goto l145;
   l146:;	  G->pos= yypos146; G->thunkpos= yythunkpos146;
-  }  yyText(G, G->begin, G->end);  if (!( EXT(pmh_EXT_NOTES) )) goto l145;  goto l144;
+  }  if (!( EXT(pmh_EXT_NOTES) )) goto l145;  goto l144;
   l145:;	  G->pos= yypos144; G->thunkpos= yythunkpos144;
   {  int yypos147= G->pos, yythunkpos147= G->thunkpos;  if (!yymatchDot(G)) goto l143;  G->pos= yypos147; G->thunkpos= yythunkpos147;
-  }  yyText(G, G->begin, G->end);  if (!( !EXT(pmh_EXT_NOTES) )) goto l143;
+  }  if (!( !EXT(pmh_EXT_NOTES) )) goto l143;
   }
-  l144:;	  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l143;
-  l148:;	
+  l144:;	  if (!(YY_BEGIN)) goto l143;  yytail= G->pos;
+  l148:;	  if (memo_label_failed(G, -1, 0)) goto l143;
   {  int yypos149= G->pos, yythunkpos149= G->thunkpos;
   {  int yypos150= G->pos, yythunkpos150= G->thunkpos;  if (!yymatchChar(G, ']')) goto l150;  goto l149;
   l150:;	  G->pos= yypos150; G->thunkpos= yythunkpos150;
   }  if (!yy_Inline(G)) { goto l149; }  goto l148;
   l149:;	  G->pos= yypos149; G->thunkpos= yythunkpos149;
-  }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l143;  yyDo(G, yy_1_Label, G->begin, G->end);  if (!yymatchChar(G, ']')) goto l143;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l143;  yyDo(G, yy_2_Label, G->begin, G->end);
+  }  if (!(YY_END)) goto l143;  yyDo(G, yy_1_Label, G->begin, G->end);  if (!yymatchChar(G, ']')) goto l143;  if (!(YY_END)) goto l143;  yyDo(G, yy_2_Label, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "Label", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
-  l143:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
+  l143:;	  if (yytail >= 0) memo_label_failed(G, yytail, yyends);
+  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "Label", G->buf+G->pos));
   return 0;
 }
 YY_RULE(int) yy_ReferenceLinkSingle(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "ReferenceLinkSingle"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l151;  if (!yy_Label(G)) { goto l151; }  yyDo(G, yySet, -1, 0);
+  yyprintf((stderr, "%s\n", "ReferenceLinkSingle"));  if (!(YY_BEGIN)) goto l151;  if (!yy_Label(G)) { goto l151; }  yyDo(G, yySet, -1, 0);
   {  int yypos152= G->pos, yythunkpos152= G->thunkpos;  if (!yy_Spnl(G)) { goto l152; }  if (!yymatchString(G, "[]")) goto l152;  goto l153;
   l152:;	  G->pos= yypos152; G->thunkpos= yythunkpos152;
   }
-  l153:;	  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l151;  yyDo(G, yy_1_ReferenceLinkSingle, G->begin, G->end);
+  l153:;	  if (!(YY_END)) goto l151;  yyDo(G, yy_1_ReferenceLinkSingle, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "ReferenceLinkSingle", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l151:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -2594,10 +5039,10 @@ YY_RULE(int) yy_ReferenceLinkSingle(GREG *G)
 }
 YY_RULE(int) yy_ReferenceLinkDouble(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 2, 0);
-  yyprintf((stderr, "%s\n", "ReferenceLinkDouble"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l154;  if (!yy_Label(G)) { goto l154; }  yyDo(G, yySet, -2, 0);  if (!yy_Spnl(G)) { goto l154; }
+  yyprintf((stderr, "%s\n", "ReferenceLinkDouble"));  if (!(YY_BEGIN)) goto l154;  if (!yy_Label(G)) { goto l154; }  yyDo(G, yySet, -2, 0);  if (!yy_Spnl(G)) { goto l154; }
   {  int yypos155= G->pos, yythunkpos155= G->thunkpos;  if (!yymatchString(G, "[]")) goto l155;  goto l154;
   l155:;	  G->pos= yypos155; G->thunkpos= yythunkpos155;
-  }  if (!yy_Label(G)) { goto l154; }  yyDo(G, yySet, -1, 0);  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l154;  yyDo(G, yy_1_ReferenceLinkDouble, G->begin, G->end);
+  }  if (!yy_Label(G)) { goto l154; }  yyDo(G, yySet, -1, 0);  if (!(YY_END)) goto l154;  yyDo(G, yy_1_ReferenceLinkDouble, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "ReferenceLinkDouble", G->buf+G->pos));  yyDo(G, yyPop, 2, 0);
   return 1;
   l154:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -2632,7 +5077,7 @@ YY_RULE(int) yy_ReferenceLink(GREG *G)
 }
 YY_RULE(int) yy_ExplicitLink(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 2, 0);
-  yyprintf((stderr, "%s\n", "ExplicitLink"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l162;  if (!yy_Label(G)) { goto l162; }  yyDo(G, yySet, -2, 0);  if (!yy_Spnl(G)) { goto l162; }  if (!yymatchChar(G, '(')) goto l162;  if (!yy_Sp(G)) { goto l162; }  if (!yy_Source(G)) { goto l162; }  yyDo(G, yySet, -1, 0);  if (!yy_Spnl(G)) { goto l162; }  if (!yy_Title(G)) { goto l162; }  if (!yy_Sp(G)) { goto l162; }  if (!yymatchChar(G, ')')) goto l162;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l162;  yyDo(G, yy_1_ExplicitLink, G->begin, G->end);
+  yyprintf((stderr, "%s\n", "ExplicitLink"));  if (!(YY_BEGIN)) goto l162;  if (!yy_Label(G)) { goto l162; }  yyDo(G, yySet, -2, 0);  if (!yy_Spnl(G)) { goto l162; }  if (!yymatchChar(G, '(')) goto l162;  if (!yy_Sp(G)) { goto l162; }  if (!yy_Source(G)) { goto l162; }  yyDo(G, yySet, -1, 0);  if (!yy_Spnl(G)) { goto l162; }  if (!yy_Title(G)) { goto l162; }  if (!yy_Sp(G)) { goto l162; }  if (!yymatchChar(G, ')')) goto l162;  if (!(YY_END)) goto l162;  yyDo(G, yy_1_ExplicitLink, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "ExplicitLink", G->buf+G->pos));  yyDo(G, yyPop, 2, 0);
   return 1;
   l162:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -2641,7 +5086,7 @@ YY_RULE(int) yy_ExplicitLink(GREG *G)
 }
 YY_RULE(int) yy_StrongUl(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "StrongUl"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l163;  if (!yy_LocMarker(G)) { goto l163; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "__")) goto l163;
+  yyprintf((stderr, "%s\n", "StrongUl"));  if (!(YY_BEGIN)) goto l163;  if (!yy_LocMarker(G)) { goto l163; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "__")) goto l163;
   {  int yypos164= G->pos, yythunkpos164= G->thunkpos;  if (!yy_Whitespace(G)) { goto l164; }  goto l163;
   l164:;	  G->pos= yypos164; G->thunkpos= yythunkpos164;
   }
@@ -2654,7 +5099,7 @@ YY_RULE(int) yy_StrongUl(GREG *G)
   l168:;	  G->pos= yypos168; G->thunkpos= yythunkpos168;
   }  if (!yy_Inline(G)) { goto l166; }  goto l165;
   l166:;	  G->pos= yypos166; G->thunkpos= yythunkpos166;
-  }  if (!yymatchString(G, "__")) goto l163;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l163;  yyDo(G, yy_1_StrongUl, G->begin, G->end);
+  }  if (!yymatchString(G, "__")) goto l163;  if (!(YY_END)) goto l163;  yyDo(G, yy_1_StrongUl, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "StrongUl", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l163:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -2663,7 +5108,7 @@ YY_RULE(int) yy_StrongUl(GREG *G)
 }
 YY_RULE(int) yy_StrongStar(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "StrongStar"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l169;  if (!yy_LocMarker(G)) { goto l169; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "**")) goto l169;
+  yyprintf((stderr, "%s\n", "StrongStar"));  if (!(YY_BEGIN)) goto l169;  if (!yy_LocMarker(G)) { goto l169; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "**")) goto l169;
   {  int yypos170= G->pos, yythunkpos170= G->thunkpos;  if (!yy_Whitespace(G)) { goto l170; }  goto l169;
   l170:;	  G->pos= yypos170; G->thunkpos= yythunkpos170;
   }
@@ -2676,7 +5121,7 @@ YY_RULE(int) yy_StrongStar(GREG *G)
   l174:;	  G->pos= yypos174; G->thunkpos= yythunkpos174;
   }  if (!yy_Inline(G)) { goto l172; }  goto l171;
   l172:;	  G->pos= yypos172; G->thunkpos= yythunkpos172;
-  }  if (!yymatchString(G, "**")) goto l169;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l169;  yyDo(G, yy_1_StrongStar, G->begin, G->end);
+  }  if (!yymatchString(G, "**")) goto l169;  if (!(YY_END)) goto l169;  yyDo(G, yy_1_StrongStar, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "StrongStar", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l169:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -2698,7 +5143,7 @@ YY_RULE(int) yy_Whitespace(GREG *G)
 }
 YY_RULE(int) yy_EmphUl(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "EmphUl"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l178;  if (!yy_LocMarker(G)) { goto l178; }  yyDo(G, yySet, -1, 0);  if (!yymatchChar(G, '_')) goto l178;
+  yyprintf((stderr, "%s\n", "EmphUl"));  if (!(YY_BEGIN)) goto l178;  if (!yy_LocMarker(G)) { goto l178; }  yyDo(G, yySet, -1, 0);  if (!yymatchChar(G, '_')) goto l178;
   {  int yypos179= G->pos, yythunkpos179= G->thunkpos;  if (!yy_Whitespace(G)) { goto l179; }  goto l178;
   l179:;	  G->pos= yypos179; G->thunkpos= yythunkpos179;
   }
@@ -2719,7 +5164,7 @@ YY_RULE(int) yy_EmphUl(GREG *G)
   }
   l185:;	  goto l180;
   l181:;	  G->pos= yypos181; G->thunkpos= yythunkpos181;
-  }  if (!yymatchChar(G, '_')) goto l178;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l178;  yyDo(G, yy_1_EmphUl, G->begin, G->end);
+  }  if (!yymatchChar(G, '_')) goto l178;  if (!(YY_END)) goto l178;  yyDo(G, yy_1_EmphUl, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "EmphUl", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l178:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -2728,7 +5173,7 @@ YY_RULE(int) yy_EmphUl(GREG *G)
 }
 YY_RULE(int) yy_EmphStar(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "EmphStar"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l188;  if (!yy_LocMarker(G)) { goto l188; }  yyDo(G, yySet, -1, 0);  if (!yymatchChar(G, '*')) goto l188;
+  yyprintf((stderr, "%s\n", "EmphStar"));  if (!(YY_BEGIN)) goto l188;  if (!yy_LocMarker(G)) { goto l188; }  yyDo(G, yySet, -1, 0);  if (!yymatchChar(G, '*')) goto l188;
   {  int yypos189= G->pos, yythunkpos189= G->thunkpos;  if (!yy_Whitespace(G)) { goto l189; }  goto l188;
   l189:;	  G->pos= yypos189; G->thunkpos= yythunkpos189;
   }
@@ -2749,7 +5194,7 @@ YY_RULE(int) yy_EmphStar(GREG *G)
   }
   l195:;	  goto l190;
   l191:;	  G->pos= yypos191; G->thunkpos= yythunkpos191;
-  }  if (!yymatchChar(G, '*')) goto l188;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l188;  yyDo(G, yy_1_EmphStar, G->begin, G->end);
+  }  if (!yymatchChar(G, '*')) goto l188;  if (!(YY_END)) goto l188;  yyDo(G, yy_1_EmphStar, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "EmphStar", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l188:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -3111,12 +5556,12 @@ YY_RULE(int) yy_EscapedChar(GREG *G)
 }
 YY_RULE(int) yy_Entity(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "Entity"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l393;  if (!yy_LocMarker(G)) { goto l393; }  yyDo(G, yySet, -1, 0);
+  yyprintf((stderr, "%s\n", "Entity"));  if (!(YY_BEGIN)) goto l393;  if (!yy_LocMarker(G)) { goto l393; }  yyDo(G, yySet, -1, 0);
   {  int yypos394= G->pos, yythunkpos394= G->thunkpos;  if (!yy_HexEntity(G)) { goto l395; }  goto l394;
   l395:;	  G->pos= yypos394; G->thunkpos= yythunkpos394;  if (!yy_DecEntity(G)) { goto l396; }  goto l394;
   l396:;	  G->pos= yypos394; G->thunkpos= yythunkpos394;  if (!yy_CharEntity(G)) { goto l393; }
   }
-  l394:;	  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l393;  yyDo(G, yy_1_Entity, G->begin, G->end);
+  l394:;	  if (!(YY_END)) goto l393;  yyDo(G, yy_1_Entity, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "Entity", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l393:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -3125,21 +5570,21 @@ YY_RULE(int) yy_Entity(GREG *G)
 }
 YY_RULE(int) yy_RawHtml(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "RawHtml"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l397;  if (!yy_LocMarker(G)) { goto l397; }  yyDo(G, yySet, -1, 0);
+  yyprintf((stderr, "%s\n", "RawHtml"));  if (!(YY_BEGIN)) goto l397;  if (!yy_LocMarker(G)) { goto l397; }  yyDo(G, yySet, -1, 0);
   {  int yypos398= G->pos, yythunkpos398= G->thunkpos;  if (!yy_HtmlComment(G)) { goto l399; }  goto l398;
   l399:;	  G->pos= yypos398; G->thunkpos= yythunkpos398;  if (!yy_HtmlBlockScript(G)) { goto l400; }  goto l398;
   l400:;	  G->pos= yypos398; G->thunkpos= yythunkpos398;  if (!yy_HtmlTag(G)) { goto l397; }
   }
-  l398:;	  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l397;  yyDo(G, yy_1_RawHtml, G->begin, G->end);
+  l398:;	  if (!(YY_END)) goto l397;  yyDo(G, yy_1_RawHtml, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "RawHtml", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l397:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "RawHtml", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_Code(GREG *G)
+YY_RULE(int) yy_Code_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "Code"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l401;
+  yyprintf((stderr, "%s\n", "Code"));  if (!(YY_BEGIN)) goto l401;
   {  int yypos402= G->pos, yythunkpos402= G->thunkpos;  if (!yy_Ticks1(G)) { goto l403; }  yyDo(G, yySet, -1, 0);  if (!yy_Sp(G)) { goto l403; }
   {  int yypos406= G->pos, yythunkpos406= G->thunkpos;
   {  int yypos410= G->pos, yythunkpos410= G->thunkpos;  if (!yymatchChar(G, '`')) goto l410;  goto l407;
@@ -3486,7 +5931,7 @@ YY_RULE(int) yy_Code(GREG *G)
   l528:;	  G->pos= yypos528; G->thunkpos= yythunkpos528;
   }  if (!yy_Sp(G)) { goto l401; }  if (!yy_Ticks5(G)) { goto l401; }
   }
-  l402:;	  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l401;  yyDo(G, yy_1_Code, G->begin, G->end);
+  l402:;	  if (!(YY_END)) goto l401;  yyDo(G, yy_1_Code, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "Code", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l401:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -3495,7 +5940,7 @@ YY_RULE(int) yy_Code(GREG *G)
 }
 YY_RULE(int) yy_InlineNote(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "InlineNote"));  yyText(G, G->begin, G->end);  if (!( EXT(pmh_EXT_NOTES) )) goto l557;  if (!yymatchString(G, "^[")) goto l557;
+  yyprintf((stderr, "%s\n", "InlineNote"));  if (!( EXT(pmh_EXT_NOTES) )) goto l557;  if (!yymatchString(G, "^[")) goto l557;
   {  int yypos560= G->pos, yythunkpos560= G->thunkpos;  if (!yymatchChar(G, ']')) goto l560;  goto l557;
   l560:;	  G->pos= yypos560; G->thunkpos= yythunkpos560;
   }  if (!yy_Inline(G)) { goto l557; }
@@ -3514,14 +5959,14 @@ YY_RULE(int) yy_InlineNote(GREG *G)
 }
 YY_RULE(int) yy_NoteReference(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "NoteReference"));  yyText(G, G->begin, G->end);  if (!( EXT(pmh_EXT_NOTES) )) goto l562;  if (!yy_RawNoteReference(G)) { goto l562; }
+  yyprintf((stderr, "%s\n", "NoteReference"));  if (!( EXT(pmh_EXT_NOTES) )) goto l562;  if (!yy_RawNoteReference(G)) { goto l562; }
   yyprintf((stderr, "  ok   %s @ %s\n", "NoteReference", G->buf+G->pos));
   return 1;
   l562:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "NoteReference", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_Link(GREG *G)
+YY_RULE(int) yy_Link_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "Link"));
   {  int yypos564= G->pos, yythunkpos564= G->thunkpos;  if (!yy_ExplicitLink(G)) { goto l565; }  goto l564;
@@ -3550,7 +5995,7 @@ YY_RULE(int) yy_Image(GREG *G)
 }
 YY_RULE(int) yy_Strike(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "Strike"));  yyText(G, G->begin, G->end);  if (!( EXT(pmh_EXT_STRIKE) )) goto l570;  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l570;  if (!yy_LocMarker(G)) { goto l570; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "~~")) goto l570;
+  yyprintf((stderr, "%s\n", "Strike"));  if (!( EXT(pmh_EXT_STRIKE) )) goto l570;  if (!(YY_BEGIN)) goto l570;  if (!yy_LocMarker(G)) { goto l570; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "~~")) goto l570;
   {  int yypos571= G->pos, yythunkpos571= G->thunkpos;  if (!yy_Whitespace(G)) { goto l571; }  goto l570;
   l571:;	  G->pos= yypos571; G->thunkpos= yythunkpos571;
   }
@@ -3563,14 +6008,14 @@ YY_RULE(int) yy_Strike(GREG *G)
   l575:;	  G->pos= yypos575; G->thunkpos= yythunkpos575;
   }  if (!yy_Inline(G)) { goto l573; }  goto l572;
   l573:;	  G->pos= yypos573; G->thunkpos= yythunkpos573;
-  }  if (!yymatchString(G, "~~")) goto l570;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l570;  yyDo(G, yy_1_Strike, G->begin, G->end);
+  }  if (!yymatchString(G, "~~")) goto l570;  if (!(YY_END)) goto l570;  yyDo(G, yy_1_Strike, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "Strike", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l570:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "Strike", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_Emph(GREG *G)
+YY_RULE(int) yy_Emph_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "Emph"));
   {  int yypos577= G->pos, yythunkpos577= G->thunkpos;  if (!yy_EmphStar(G)) { goto l578; }  goto l577;
@@ -3583,7 +6028,7 @@ YY_RULE(int) yy_Emph(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "Emph", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_Strong(GREG *G)
+YY_RULE(int) yy_Strong_unmemoized(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "Strong"));
   {  int yypos580= G->pos, yythunkpos580= G->thunkpos;  if (!yy_StrongStar(G)) { goto l581; }  goto l580;
@@ -3787,14 +6232,14 @@ YY_RULE(int) yy_HtmlBlockSelfClosing(GREG *G)
 }
 YY_RULE(int) yy_HtmlComment(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "HtmlComment"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l682;  if (!yy_LocMarker(G)) { goto l682; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "<!--")) goto l682;
+  yyprintf((stderr, "%s\n", "HtmlComment"));  if (!(YY_BEGIN)) goto l682;  if (!yy_LocMarker(G)) { goto l682; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "<!--")) goto l682;
   l683:;	
   {  int yypos684= G->pos, yythunkpos684= G->thunkpos;
   {  int yypos685= G->pos, yythunkpos685= G->thunkpos;  if (!yymatchString(G, "-->")) goto l685;  goto l684;
   l685:;	  G->pos= yypos685; G->thunkpos= yythunkpos685;
   }  if (!yymatchDot(G)) goto l684;  goto l683;
   l684:;	  G->pos= yypos684; G->thunkpos= yythunkpos684;
-  }  if (!yymatchString(G, "-->")) goto l682;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l682;  yyDo(G, yy_1_HtmlComment, G->begin, G->end);
+  }  if (!yymatchString(G, "-->")) goto l682;  if (!(YY_END)) goto l682;  yyDo(G, yy_1_HtmlComment, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "HtmlComment", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l682:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -4840,7 +7285,7 @@ YY_RULE(int) yy_HtmlBlockOpenMenu(GREG *G)
 }
 YY_RULE(int) yy_HtmlBlockH6(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "HtmlBlockH6"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l997;  if (!yy_LocMarker(G)) { goto l997; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH6(G)) { goto l997; }
+  yyprintf((stderr, "%s\n", "HtmlBlockH6"));  if (!(YY_BEGIN)) goto l997;  if (!yy_LocMarker(G)) { goto l997; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH6(G)) { goto l997; }
   l998:;	
   {  int yypos999= G->pos, yythunkpos999= G->thunkpos;
   {  int yypos1000= G->pos, yythunkpos1000= G->thunkpos;  if (!yy_HtmlBlockH6(G)) { goto l1001; }  goto l1000;
@@ -4851,7 +7296,7 @@ YY_RULE(int) yy_HtmlBlockH6(GREG *G)
   }
   l1000:;	  goto l998;
   l999:;	  G->pos= yypos999; G->thunkpos= yythunkpos999;
-  }  if (!yy_HtmlBlockCloseH6(G)) { goto l997; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l997;  yyDo(G, yy_1_HtmlBlockH6, G->begin, G->end);
+  }  if (!yy_HtmlBlockCloseH6(G)) { goto l997; }  if (!(YY_END)) goto l997;  yyDo(G, yy_1_HtmlBlockH6, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "HtmlBlockH6", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l997:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -4890,7 +7335,7 @@ YY_RULE(int) yy_HtmlBlockOpenH6(GREG *G)
 }
 YY_RULE(int) yy_HtmlBlockH5(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "HtmlBlockH5"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1011;  if (!yy_LocMarker(G)) { goto l1011; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH5(G)) { goto l1011; }
+  yyprintf((stderr, "%s\n", "HtmlBlockH5"));  if (!(YY_BEGIN)) goto l1011;  if (!yy_LocMarker(G)) { goto l1011; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH5(G)) { goto l1011; }
   l1012:;	
   {  int yypos1013= G->pos, yythunkpos1013= G->thunkpos;
   {  int yypos1014= G->pos, yythunkpos1014= G->thunkpos;  if (!yy_HtmlBlockH5(G)) { goto l1015; }  goto l1014;
@@ -4901,7 +7346,7 @@ YY_RULE(int) yy_HtmlBlockH5(GREG *G)
   }
   l1014:;	  goto l1012;
   l1013:;	  G->pos= yypos1013; G->thunkpos= yythunkpos1013;
-  }  if (!yy_HtmlBlockCloseH5(G)) { goto l1011; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1011;  yyDo(G, yy_1_HtmlBlockH5, G->begin, G->end);
+  }  if (!yy_HtmlBlockCloseH5(G)) { goto l1011; }  if (!(YY_END)) goto l1011;  yyDo(G, yy_1_HtmlBlockH5, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "HtmlBlockH5", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l1011:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -4940,7 +7385,7 @@ YY_RULE(int) yy_HtmlBlockOpenH5(GREG *G)
 }
 YY_RULE(int) yy_HtmlBlockH4(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "HtmlBlockH4"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1025;  if (!yy_LocMarker(G)) { goto l1025; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH4(G)) { goto l1025; }
+  yyprintf((stderr, "%s\n", "HtmlBlockH4"));  if (!(YY_BEGIN)) goto l1025;  if (!yy_LocMarker(G)) { goto l1025; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH4(G)) { goto l1025; }
   l1026:;	
   {  int yypos1027= G->pos, yythunkpos1027= G->thunkpos;
   {  int yypos1028= G->pos, yythunkpos1028= G->thunkpos;  if (!yy_HtmlBlockH4(G)) { goto l1029; }  goto l1028;
@@ -4951,7 +7396,7 @@ YY_RULE(int) yy_HtmlBlockH4(GREG *G)
   }
   l1028:;	  goto l1026;
   l1027:;	  G->pos= yypos1027; G->thunkpos= yythunkpos1027;
-  }  if (!yy_HtmlBlockCloseH4(G)) { goto l1025; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1025;  yyDo(G, yy_1_HtmlBlockH4, G->begin, G->end);
+  }  if (!yy_HtmlBlockCloseH4(G)) { goto l1025; }  if (!(YY_END)) goto l1025;  yyDo(G, yy_1_HtmlBlockH4, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "HtmlBlockH4", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l1025:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -4990,7 +7435,7 @@ YY_RULE(int) yy_HtmlBlockOpenH4(GREG *G)
 }
 YY_RULE(int) yy_HtmlBlockH3(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "HtmlBlockH3"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1039;  if (!yy_LocMarker(G)) { goto l1039; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH3(G)) { goto l1039; }
+  yyprintf((stderr, "%s\n", "HtmlBlockH3"));  if (!(YY_BEGIN)) goto l1039;  if (!yy_LocMarker(G)) { goto l1039; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH3(G)) { goto l1039; }
   l1040:;	
   {  int yypos1041= G->pos, yythunkpos1041= G->thunkpos;
   {  int yypos1042= G->pos, yythunkpos1042= G->thunkpos;  if (!yy_HtmlBlockH3(G)) { goto l1043; }  goto l1042;
@@ -5001,7 +7446,7 @@ YY_RULE(int) yy_HtmlBlockH3(GREG *G)
   }
   l1042:;	  goto l1040;
   l1041:;	  G->pos= yypos1041; G->thunkpos= yythunkpos1041;
-  }  if (!yy_HtmlBlockCloseH3(G)) { goto l1039; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1039;  yyDo(G, yy_1_HtmlBlockH3, G->begin, G->end);
+  }  if (!yy_HtmlBlockCloseH3(G)) { goto l1039; }  if (!(YY_END)) goto l1039;  yyDo(G, yy_1_HtmlBlockH3, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "HtmlBlockH3", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l1039:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -5040,7 +7485,7 @@ YY_RULE(int) yy_HtmlBlockOpenH3(GREG *G)
 }
 YY_RULE(int) yy_HtmlBlockH2(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "HtmlBlockH2"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1053;  if (!yy_LocMarker(G)) { goto l1053; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH2(G)) { goto l1053; }
+  yyprintf((stderr, "%s\n", "HtmlBlockH2"));  if (!(YY_BEGIN)) goto l1053;  if (!yy_LocMarker(G)) { goto l1053; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH2(G)) { goto l1053; }
   l1054:;	
   {  int yypos1055= G->pos, yythunkpos1055= G->thunkpos;
   {  int yypos1056= G->pos, yythunkpos1056= G->thunkpos;  if (!yy_HtmlBlockH2(G)) { goto l1057; }  goto l1056;
@@ -5051,7 +7496,7 @@ YY_RULE(int) yy_HtmlBlockH2(GREG *G)
   }
   l1056:;	  goto l1054;
   l1055:;	  G->pos= yypos1055; G->thunkpos= yythunkpos1055;
-  }  if (!yy_HtmlBlockCloseH2(G)) { goto l1053; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1053;  yyDo(G, yy_1_HtmlBlockH2, G->begin, G->end);
+  }  if (!yy_HtmlBlockCloseH2(G)) { goto l1053; }  if (!(YY_END)) goto l1053;  yyDo(G, yy_1_HtmlBlockH2, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "HtmlBlockH2", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l1053:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -5090,7 +7535,7 @@ YY_RULE(int) yy_HtmlBlockOpenH2(GREG *G)
 }
 YY_RULE(int) yy_HtmlBlockH1(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "HtmlBlockH1"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1067;  if (!yy_LocMarker(G)) { goto l1067; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH1(G)) { goto l1067; }
+  yyprintf((stderr, "%s\n", "HtmlBlockH1"));  if (!(YY_BEGIN)) goto l1067;  if (!yy_LocMarker(G)) { goto l1067; }  yyDo(G, yySet, -1, 0);  if (!yy_HtmlBlockOpenH1(G)) { goto l1067; }
   l1068:;	
   {  int yypos1069= G->pos, yythunkpos1069= G->thunkpos;
   {  int yypos1070= G->pos, yythunkpos1070= G->thunkpos;  if (!yy_HtmlBlockH1(G)) { goto l1071; }  goto l1070;
@@ -5101,7 +7546,7 @@ YY_RULE(int) yy_HtmlBlockH1(GREG *G)
   }
   l1070:;	  goto l1068;
   l1069:;	  G->pos= yypos1069; G->thunkpos= yythunkpos1069;
-  }  if (!yy_HtmlBlockCloseH1(G)) { goto l1067; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1067;  yyDo(G, yy_1_HtmlBlockH1, G->begin, G->end);
+  }  if (!yy_HtmlBlockCloseH1(G)) { goto l1067; }  if (!(YY_END)) goto l1067;  yyDo(G, yy_1_HtmlBlockH1, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "HtmlBlockH1", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l1067:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -5644,11 +8089,11 @@ YY_RULE(int) yy_ListBlockLine(GREG *G)
 }
 YY_RULE(int) yy_ListContinuationBlock(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "ListContinuationBlock"));  if (!yy_StartList(G)) { goto l1225; }  yyDo(G, yySet, -1, 0);  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1225;
+  yyprintf((stderr, "%s\n", "ListContinuationBlock"));  if (!yy_StartList(G)) { goto l1225; }  yyDo(G, yySet, -1, 0);  if (!(YY_BEGIN)) goto l1225;
   l1226:;	
   {  int yypos1227= G->pos, yythunkpos1227= G->thunkpos;  if (!yy_BlankLine(G)) { goto l1227; }  goto l1226;
   l1227:;	  G->pos= yypos1227; G->thunkpos= yythunkpos1227;
-  }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1225;  yyDo(G, yy_1_ListContinuationBlock, G->begin, G->end);  if (!yy_Indent(G)) { goto l1225; }  if (!yy_ListBlock(G)) { goto l1225; }  yyDo(G, yy_2_ListContinuationBlock, G->begin, G->end);
+  }  if (!(YY_END)) goto l1225;  yyDo(G, yy_1_ListContinuationBlock, G->begin, G->end);  if (!yy_Indent(G)) { goto l1225; }  if (!yy_ListBlock(G)) { goto l1225; }  yyDo(G, yy_2_ListContinuationBlock, G->begin, G->end);
   l1228:;	
   {  int yypos1229= G->pos, yythunkpos1229= G->thunkpos;  if (!yy_Indent(G)) { goto l1229; }  if (!yy_ListBlock(G)) { goto l1229; }  yyDo(G, yy_2_ListContinuationBlock, G->begin, G->end);  goto l1228;
   l1229:;	  G->pos= yypos1229; G->thunkpos= yythunkpos1229;
@@ -5694,11 +8139,11 @@ YY_RULE(int) yy_ListItem(GREG *G)
 }
 YY_RULE(int) yy_Enumerator(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "Enumerator"));  if (!yy_NonindentSpace(G)) { goto l1239; }  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1239;  if (!yymatchClass(G, (unsigned char *)"\000\000\000\000\000\000\377\003\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l1239;
+  yyprintf((stderr, "%s\n", "Enumerator"));  if (!yy_NonindentSpace(G)) { goto l1239; }  if (!(YY_BEGIN)) goto l1239;  if (!yymatchClass(G, (unsigned char *)"\000\000\000\000\000\000\377\003\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l1239;
   l1240:;	
   {  int yypos1241= G->pos, yythunkpos1241= G->thunkpos;  if (!yymatchClass(G, (unsigned char *)"\000\000\000\000\000\000\377\003\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000")) goto l1241;  goto l1240;
   l1241:;	  G->pos= yypos1241; G->thunkpos= yythunkpos1241;
-  }  if (!yymatchChar(G, '.')) goto l1239;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1239;  if (!yy_Spacechar(G)) { goto l1239; }
+  }  if (!yymatchChar(G, '.')) goto l1239;  if (!(YY_END)) goto l1239;  if (!yy_Spacechar(G)) { goto l1239; }
   l1242:;	
   {  int yypos1243= G->pos, yythunkpos1243= G->thunkpos;  if (!yy_Spacechar(G)) { goto l1243; }  goto l1242;
   l1243:;	  G->pos= yypos1243; G->thunkpos= yythunkpos1243;
@@ -5795,12 +8240,12 @@ YY_RULE(int) yy_Bullet(GREG *G)
   yyprintf((stderr, "%s\n", "Bullet"));
   {  int yypos1270= G->pos, yythunkpos1270= G->thunkpos;  if (!yy_HorizontalRule(G)) { goto l1270; }  goto l1269;
   l1270:;	  G->pos= yypos1270; G->thunkpos= yythunkpos1270;
-  }  if (!yy_NonindentSpace(G)) { goto l1269; }  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1269;
+  }  if (!yy_NonindentSpace(G)) { goto l1269; }  if (!(YY_BEGIN)) goto l1269;
   {  int yypos1271= G->pos, yythunkpos1271= G->thunkpos;  if (!yymatchChar(G, '+')) goto l1272;  goto l1271;
   l1272:;	  G->pos= yypos1271; G->thunkpos= yythunkpos1271;  if (!yymatchChar(G, '*')) goto l1273;  goto l1271;
   l1273:;	  G->pos= yypos1271; G->thunkpos= yythunkpos1271;  if (!yymatchChar(G, '-')) goto l1269;
   }
-  l1271:;	  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1269;  if (!yy_Spacechar(G)) { goto l1269; }
+  l1271:;	  if (!(YY_END)) goto l1269;  if (!yy_Spacechar(G)) { goto l1269; }
   l1274:;	
   {  int yypos1275= G->pos, yythunkpos1275= G->thunkpos;  if (!yy_Spacechar(G)) { goto l1275; }  goto l1274;
   l1275:;	  G->pos= yypos1275; G->thunkpos= yythunkpos1275;
@@ -5871,11 +8316,11 @@ YY_RULE(int) yy_StartList(GREG *G)
 }
 YY_RULE(int) yy_BlockQuoteRaw(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "BlockQuoteRaw"));  if (!yy_StartList(G)) { goto l1287; }  yyDo(G, yySet, -1, 0);  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1287;  if (!yymatchChar(G, '>')) goto l1287;
+  yyprintf((stderr, "%s\n", "BlockQuoteRaw"));  if (!yy_StartList(G)) { goto l1287; }  yyDo(G, yySet, -1, 0);  if (!(YY_BEGIN)) goto l1287;  if (!yymatchChar(G, '>')) goto l1287;
   {  int yypos1290= G->pos, yythunkpos1290= G->thunkpos;  if (!yymatchChar(G, ' ')) goto l1290;  goto l1291;
   l1290:;	  G->pos= yypos1290; G->thunkpos= yythunkpos1290;
   }
-  l1291:;	  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1287;  yyDo(G, yy_1_BlockQuoteRaw, G->begin, G->end);  if (!yy_Line(G)) { goto l1287; }  yyDo(G, yy_2_BlockQuoteRaw, G->begin, G->end);
+  l1291:;	  if (!(YY_END)) goto l1287;  yyDo(G, yy_1_BlockQuoteRaw, G->begin, G->end);  if (!yy_Line(G)) { goto l1287; }  yyDo(G, yy_2_BlockQuoteRaw, G->begin, G->end);
   l1292:;	
   {  int yypos1293= G->pos, yythunkpos1293= G->thunkpos;
   {  int yypos1294= G->pos, yythunkpos1294= G->thunkpos;  if (!yymatchChar(G, '>')) goto l1294;  goto l1293;
@@ -5887,15 +8332,15 @@ YY_RULE(int) yy_BlockQuoteRaw(GREG *G)
   l1293:;	  G->pos= yypos1293; G->thunkpos= yythunkpos1293;
   }
   l1296:;	
-  {  int yypos1297= G->pos, yythunkpos1297= G->thunkpos;  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1297;  if (!yy_BlankLine(G)) { goto l1297; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1297;  yyDo(G, yy_4_BlockQuoteRaw, G->begin, G->end);  goto l1296;
+  {  int yypos1297= G->pos, yythunkpos1297= G->thunkpos;  if (!(YY_BEGIN)) goto l1297;  if (!yy_BlankLine(G)) { goto l1297; }  if (!(YY_END)) goto l1297;  yyDo(G, yy_4_BlockQuoteRaw, G->begin, G->end);  goto l1296;
   l1297:;	  G->pos= yypos1297; G->thunkpos= yythunkpos1297;
   }
   l1288:;	
-  {  int yypos1289= G->pos, yythunkpos1289= G->thunkpos;  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1289;  if (!yymatchChar(G, '>')) goto l1289;
+  {  int yypos1289= G->pos, yythunkpos1289= G->thunkpos;  if (!(YY_BEGIN)) goto l1289;  if (!yymatchChar(G, '>')) goto l1289;
   {  int yypos1298= G->pos, yythunkpos1298= G->thunkpos;  if (!yymatchChar(G, ' ')) goto l1298;  goto l1299;
   l1298:;	  G->pos= yypos1298; G->thunkpos= yythunkpos1298;
   }
-  l1299:;	  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1289;  yyDo(G, yy_1_BlockQuoteRaw, G->begin, G->end);  if (!yy_Line(G)) { goto l1289; }  yyDo(G, yy_2_BlockQuoteRaw, G->begin, G->end);
+  l1299:;	  if (!(YY_END)) goto l1289;  yyDo(G, yy_1_BlockQuoteRaw, G->begin, G->end);  if (!yy_Line(G)) { goto l1289; }  yyDo(G, yy_2_BlockQuoteRaw, G->begin, G->end);
   l1300:;	
   {  int yypos1301= G->pos, yythunkpos1301= G->thunkpos;
   {  int yypos1302= G->pos, yythunkpos1302= G->thunkpos;  if (!yymatchChar(G, '>')) goto l1302;  goto l1301;
@@ -5907,7 +8352,7 @@ YY_RULE(int) yy_BlockQuoteRaw(GREG *G)
   l1301:;	  G->pos= yypos1301; G->thunkpos= yythunkpos1301;
   }
   l1304:;	
-  {  int yypos1305= G->pos, yythunkpos1305= G->thunkpos;  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1305;  if (!yy_BlankLine(G)) { goto l1305; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1305;  yyDo(G, yy_4_BlockQuoteRaw, G->begin, G->end);  goto l1304;
+  {  int yypos1305= G->pos, yythunkpos1305= G->thunkpos;  if (!(YY_BEGIN)) goto l1305;  if (!yy_BlankLine(G)) { goto l1305; }  if (!(YY_END)) goto l1305;  yyDo(G, yy_4_BlockQuoteRaw, G->begin, G->end);  goto l1304;
   l1305:;	  G->pos= yypos1305; G->thunkpos= yythunkpos1305;
   }  goto l1288;
   l1289:;	  G->pos= yypos1289; G->thunkpos= yythunkpos1289;
@@ -5935,7 +8380,7 @@ YY_RULE(int) yy_Endline(GREG *G)
 YY_RULE(int) yy_RawLine(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "RawLine"));
-  {  int yypos1311= G->pos, yythunkpos1311= G->thunkpos;  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1312;
+  {  int yypos1311= G->pos, yythunkpos1311= G->thunkpos;  if (!(YY_BEGIN)) goto l1312;
   l1313:;	
   {  int yypos1314= G->pos, yythunkpos1314= G->thunkpos;
   {  int yypos1315= G->pos, yythunkpos1315= G->thunkpos;  if (!yymatchChar(G, '\r')) goto l1315;  goto l1314;
@@ -5945,12 +8390,12 @@ YY_RULE(int) yy_RawLine(GREG *G)
   l1316:;	  G->pos= yypos1316; G->thunkpos= yythunkpos1316;
   }  if (!yymatchDot(G)) goto l1314;  goto l1313;
   l1314:;	  G->pos= yypos1314; G->thunkpos= yythunkpos1314;
-  }  if (!yy_Newline(G)) { goto l1312; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1312;  goto l1311;
-  l1312:;	  G->pos= yypos1311; G->thunkpos= yythunkpos1311;  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1310;  if (!yymatchDot(G)) goto l1310;
+  }  if (!yy_Newline(G)) { goto l1312; }  if (!(YY_END)) goto l1312;  goto l1311;
+  l1312:;	  G->pos= yypos1311; G->thunkpos= yythunkpos1311;  if (!(YY_BEGIN)) goto l1310;  if (!yymatchDot(G)) goto l1310;
   l1317:;	
   {  int yypos1318= G->pos, yythunkpos1318= G->thunkpos;  if (!yymatchDot(G)) goto l1318;  goto l1317;
   l1318:;	  G->pos= yypos1318; G->thunkpos= yythunkpos1318;
-  }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1310;  if (!yy_Eof(G)) { goto l1310; }
+  }  if (!(YY_END)) goto l1310;  if (!yy_Eof(G)) { goto l1310; }
   }
   l1311:;	  yyDo(G, yy_1_RawLine, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "RawLine", G->buf+G->pos));
@@ -5989,7 +8434,7 @@ YY_RULE(int) yy_SetextHeading2(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "SetextHeading2"));
   {  int yypos1326= G->pos, yythunkpos1326= G->thunkpos;  if (!yy_RawLine(G)) { goto l1325; }  if (!yy_SetextBottom2(G)) { goto l1325; }  G->pos= yypos1326; G->thunkpos= yythunkpos1326;
-  }  if (!yy_LocMarker(G)) { goto l1325; }  yyDo(G, yySet, -1, 0);  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1325;
+  }  if (!yy_LocMarker(G)) { goto l1325; }  yyDo(G, yySet, -1, 0);  if (!(YY_BEGIN)) goto l1325;
   {  int yypos1329= G->pos, yythunkpos1329= G->thunkpos;  if (!yy_Endline(G)) { goto l1329; }  goto l1325;
   l1329:;	  G->pos= yypos1329; G->thunkpos= yythunkpos1329;
   }  if (!yy_Inline(G)) { goto l1325; }
@@ -5999,7 +8444,7 @@ YY_RULE(int) yy_SetextHeading2(GREG *G)
   l1330:;	  G->pos= yypos1330; G->thunkpos= yythunkpos1330;
   }  if (!yy_Inline(G)) { goto l1328; }  goto l1327;
   l1328:;	  G->pos= yypos1328; G->thunkpos= yythunkpos1328;
-  }  if (!yy_Sp(G)) { goto l1325; }  if (!yy_Newline(G)) { goto l1325; }  if (!yy_SetextBottom2(G)) { goto l1325; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1325;  yyDo(G, yy_1_SetextHeading2, G->begin, G->end);
+  }  if (!yy_Sp(G)) { goto l1325; }  if (!yy_Newline(G)) { goto l1325; }  if (!yy_SetextBottom2(G)) { goto l1325; }  if (!(YY_END)) goto l1325;  yyDo(G, yy_1_SetextHeading2, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "SetextHeading2", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l1325:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -6010,7 +8455,7 @@ YY_RULE(int) yy_SetextHeading1(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "SetextHeading1"));
   {  int yypos1332= G->pos, yythunkpos1332= G->thunkpos;  if (!yy_RawLine(G)) { goto l1331; }  if (!yy_SetextBottom1(G)) { goto l1331; }  G->pos= yypos1332; G->thunkpos= yythunkpos1332;
-  }  if (!yy_LocMarker(G)) { goto l1331; }  yyDo(G, yySet, -1, 0);  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1331;
+  }  if (!yy_LocMarker(G)) { goto l1331; }  yyDo(G, yySet, -1, 0);  if (!(YY_BEGIN)) goto l1331;
   {  int yypos1335= G->pos, yythunkpos1335= G->thunkpos;  if (!yy_Endline(G)) { goto l1335; }  goto l1331;
   l1335:;	  G->pos= yypos1335; G->thunkpos= yythunkpos1335;
   }  if (!yy_Inline(G)) { goto l1331; }
@@ -6020,7 +8465,7 @@ YY_RULE(int) yy_SetextHeading1(GREG *G)
   l1336:;	  G->pos= yypos1336; G->thunkpos= yythunkpos1336;
   }  if (!yy_Inline(G)) { goto l1334; }  goto l1333;
   l1334:;	  G->pos= yypos1334; G->thunkpos= yythunkpos1334;
-  }  if (!yy_Sp(G)) { goto l1331; }  if (!yy_Newline(G)) { goto l1331; }  if (!yy_SetextBottom1(G)) { goto l1331; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1331;  yyDo(G, yy_1_SetextHeading1, G->begin, G->end);
+  }  if (!yy_Sp(G)) { goto l1331; }  if (!yy_Newline(G)) { goto l1331; }  if (!yy_SetextBottom1(G)) { goto l1331; }  if (!(YY_END)) goto l1331;  yyDo(G, yy_1_SetextHeading1, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "SetextHeading1", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l1331:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -6042,7 +8487,7 @@ YY_RULE(int) yy_SetextHeading(GREG *G)
 }
 YY_RULE(int) yy_AtxHeading(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "AtxHeading"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1340;  if (!yy_AtxStart(G)) { goto l1340; }  yyDo(G, yySet, -1, 0);  if (!yy_Sp(G)) { goto l1340; }  if (!yy_AtxInline(G)) { goto l1340; }
+  yyprintf((stderr, "%s\n", "AtxHeading"));  if (!(YY_BEGIN)) goto l1340;  if (!yy_AtxStart(G)) { goto l1340; }  yyDo(G, yySet, -1, 0);  if (!yy_Sp(G)) { goto l1340; }  if (!yy_AtxInline(G)) { goto l1340; }
   l1341:;	
   {  int yypos1342= G->pos, yythunkpos1342= G->thunkpos;  if (!yy_AtxInline(G)) { goto l1342; }  goto l1341;
   l1342:;	  G->pos= yypos1342; G->thunkpos= yythunkpos1342;
@@ -6054,7 +8499,7 @@ YY_RULE(int) yy_AtxHeading(GREG *G)
   }  if (!yy_Sp(G)) { goto l1343; }  goto l1344;
   l1343:;	  G->pos= yypos1343; G->thunkpos= yythunkpos1343;
   }
-  l1344:;	  if (!yy_Newline(G)) { goto l1340; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1340;  yyDo(G, yy_1_AtxHeading, G->begin, G->end);
+  l1344:;	  if (!yy_Newline(G)) { goto l1340; }  if (!(YY_END)) goto l1340;  yyDo(G, yy_1_AtxHeading, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "AtxHeading", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l1340:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -6063,7 +8508,7 @@ YY_RULE(int) yy_AtxHeading(GREG *G)
 }
 YY_RULE(int) yy_AtxStart(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "AtxStart"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1347;
+  yyprintf((stderr, "%s\n", "AtxStart"));  if (!(YY_BEGIN)) goto l1347;
   {  int yypos1348= G->pos, yythunkpos1348= G->thunkpos;  if (!yymatchString(G, "######")) goto l1349;  goto l1348;
   l1349:;	  G->pos= yypos1348; G->thunkpos= yythunkpos1348;  if (!yymatchString(G, "#####")) goto l1350;  goto l1348;
   l1350:;	  G->pos= yypos1348; G->thunkpos= yythunkpos1348;  if (!yymatchString(G, "####")) goto l1351;  goto l1348;
@@ -6071,7 +8516,7 @@ YY_RULE(int) yy_AtxStart(GREG *G)
   l1352:;	  G->pos= yypos1348; G->thunkpos= yythunkpos1348;  if (!yymatchString(G, "##")) goto l1353;  goto l1348;
   l1353:;	  G->pos= yypos1348; G->thunkpos= yythunkpos1348;  if (!yymatchChar(G, '#')) goto l1347;
   }
-  l1348:;	  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1347;  yyDo(G, yy_1_AtxStart, G->begin, G->end);
+  l1348:;	  if (!(YY_END)) goto l1347;  yyDo(G, yy_1_AtxStart, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "AtxStart", G->buf+G->pos));
   return 1;
   l1347:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -6225,7 +8670,7 @@ YY_RULE(int) yy_Para(GREG *G)
 }
 YY_RULE(int) yy_StyleBlock(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "StyleBlock"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1406;  if (!yy_LocMarker(G)) { goto l1406; }  yyDo(G, yySet, -1, 0);  if (!yy_InStyleTags(G)) { goto l1406; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1406;
+  yyprintf((stderr, "%s\n", "StyleBlock"));  if (!(YY_BEGIN)) goto l1406;  if (!yy_LocMarker(G)) { goto l1406; }  yyDo(G, yySet, -1, 0);  if (!yy_InStyleTags(G)) { goto l1406; }  if (!(YY_END)) goto l1406;
   l1407:;	
   {  int yypos1408= G->pos, yythunkpos1408= G->thunkpos;  if (!yy_BlankLine(G)) { goto l1408; }  goto l1407;
   l1408:;	  G->pos= yypos1408; G->thunkpos= yythunkpos1408;
@@ -6238,12 +8683,12 @@ YY_RULE(int) yy_StyleBlock(GREG *G)
 }
 YY_RULE(int) yy_HtmlBlock(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "HtmlBlock"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1409;  if (!yy_LocMarker(G)) { goto l1409; }  yyDo(G, yySet, -1, 0);
+  yyprintf((stderr, "%s\n", "HtmlBlock"));  if (!(YY_BEGIN)) goto l1409;  if (!yy_LocMarker(G)) { goto l1409; }  yyDo(G, yySet, -1, 0);
   {  int yypos1410= G->pos, yythunkpos1410= G->thunkpos;  if (!yy_HtmlBlockInTags(G)) { goto l1411; }  goto l1410;
   l1411:;	  G->pos= yypos1410; G->thunkpos= yythunkpos1410;  if (!yy_HtmlComment(G)) { goto l1412; }  goto l1410;
   l1412:;	  G->pos= yypos1410; G->thunkpos= yythunkpos1410;  if (!yy_HtmlBlockSelfClosing(G)) { goto l1409; }
   }
-  l1410:;	  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1409;  if (!yy_BlankLine(G)) { goto l1409; }
+  l1410:;	  if (!(YY_END)) goto l1409;  if (!yy_BlankLine(G)) { goto l1409; }
   l1413:;	
   {  int yypos1414= G->pos, yythunkpos1414= G->thunkpos;  if (!yy_BlankLine(G)) { goto l1414; }  goto l1413;
   l1414:;	  G->pos= yypos1414; G->thunkpos= yythunkpos1414;
@@ -6299,7 +8744,7 @@ YY_RULE(int) yy_Heading(GREG *G)
 }
 YY_RULE(int) yy_HorizontalRule(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "HorizontalRule"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1426;  if (!yy_NonindentSpace(G)) { goto l1426; }
+  yyprintf((stderr, "%s\n", "HorizontalRule"));  if (!(YY_BEGIN)) goto l1426;  if (!yy_NonindentSpace(G)) { goto l1426; }
   {  int yypos1427= G->pos, yythunkpos1427= G->thunkpos;  if (!yymatchChar(G, '*')) goto l1428;  if (!yy_Sp(G)) { goto l1428; }  if (!yymatchChar(G, '*')) goto l1428;  if (!yy_Sp(G)) { goto l1428; }  if (!yymatchChar(G, '*')) goto l1428;
   l1429:;	
   {  int yypos1430= G->pos, yythunkpos1430= G->thunkpos;  if (!yy_Sp(G)) { goto l1430; }  if (!yymatchChar(G, '*')) goto l1430;  goto l1429;
@@ -6316,7 +8761,7 @@ YY_RULE(int) yy_HorizontalRule(GREG *G)
   l1435:;	  G->pos= yypos1435; G->thunkpos= yythunkpos1435;
   }
   }
-  l1427:;	  if (!yy_Sp(G)) { goto l1426; }  if (!yy_Newline(G)) { goto l1426; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1426;  if (!yy_BlankLine(G)) { goto l1426; }
+  l1427:;	  if (!yy_Sp(G)) { goto l1426; }  if (!yy_Newline(G)) { goto l1426; }  if (!(YY_END)) goto l1426;  if (!yy_BlankLine(G)) { goto l1426; }
   l1436:;	
   {  int yypos1437= G->pos, yythunkpos1437= G->thunkpos;  if (!yy_BlankLine(G)) { goto l1437; }  goto l1436;
   l1437:;	  G->pos= yypos1437; G->thunkpos= yythunkpos1437;
@@ -6329,10 +8774,10 @@ YY_RULE(int) yy_HorizontalRule(GREG *G)
 }
 YY_RULE(int) yy_Reference(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 3, 0);
-  yyprintf((stderr, "%s\n", "Reference"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1438;  if (!yy_LocMarker(G)) { goto l1438; }  yyDo(G, yySet, -3, 0);  if (!yy_NonindentSpace(G)) { goto l1438; }
+  yyprintf((stderr, "%s\n", "Reference"));  if (!(YY_BEGIN)) goto l1438;  if (!yy_LocMarker(G)) { goto l1438; }  yyDo(G, yySet, -3, 0);  if (!yy_NonindentSpace(G)) { goto l1438; }
   {  int yypos1439= G->pos, yythunkpos1439= G->thunkpos;  if (!yymatchString(G, "[]")) goto l1439;  goto l1438;
   l1439:;	  G->pos= yypos1439; G->thunkpos= yythunkpos1439;
-  }  if (!yy_Label(G)) { goto l1438; }  yyDo(G, yySet, -2, 0);  if (!yymatchChar(G, ':')) goto l1438;  if (!yy_Spnl(G)) { goto l1438; }  if (!yy_RefSrc(G)) { goto l1438; }  yyDo(G, yySet, -1, 0);  if (!yy_RefTitle(G)) { goto l1438; }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1438;  if (!yy_BlankLine(G)) { goto l1438; }
+  }  if (!yy_Label(G)) { goto l1438; }  yyDo(G, yySet, -2, 0);  if (!yymatchChar(G, ':')) goto l1438;  if (!yy_Spnl(G)) { goto l1438; }  if (!yy_RefSrc(G)) { goto l1438; }  yyDo(G, yySet, -1, 0);  if (!yy_RefTitle(G)) { goto l1438; }  if (!(YY_END)) goto l1438;  if (!yy_BlankLine(G)) { goto l1438; }
   l1440:;	
   {  int yypos1441= G->pos, yythunkpos1441= G->thunkpos;  if (!yy_BlankLine(G)) { goto l1441; }  goto l1440;
   l1441:;	  G->pos= yypos1441; G->thunkpos= yythunkpos1441;
@@ -6345,7 +8790,7 @@ YY_RULE(int) yy_Reference(GREG *G)
 }
 YY_RULE(int) yy_Note(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
-  yyprintf((stderr, "%s\n", "Note"));  yyText(G, G->begin, G->end);  if (!( EXT(pmh_EXT_NOTES) )) goto l1442;  if (!yy_NonindentSpace(G)) { goto l1442; }  if (!yy_RawNoteReference(G)) { goto l1442; }  if (!yymatchChar(G, ':')) goto l1442;  if (!yy_Sp(G)) { goto l1442; }  if (!yy_RawNoteBlock(G)) { goto l1442; }
+  yyprintf((stderr, "%s\n", "Note"));  if (!( EXT(pmh_EXT_NOTES) )) goto l1442;  if (!yy_NonindentSpace(G)) { goto l1442; }  if (!yy_RawNoteReference(G)) { goto l1442; }  if (!yymatchChar(G, ':')) goto l1442;  if (!yy_Sp(G)) { goto l1442; }  if (!yy_RawNoteBlock(G)) { goto l1442; }
   l1443:;	
   {  int yypos1444= G->pos, yythunkpos1444= G->thunkpos;
   {  int yypos1445= G->pos, yythunkpos1445= G->thunkpos;  if (!yy_Indent(G)) { goto l1444; }  G->pos= yypos1445; G->thunkpos= yythunkpos1445;
@@ -6360,11 +8805,11 @@ YY_RULE(int) yy_Note(GREG *G)
 }
 YY_RULE(int) yy_Verbatim(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
-  yyprintf((stderr, "%s\n", "Verbatim"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l1446;  if (!yy_LocMarker(G)) { goto l1446; }  yyDo(G, yySet, -1, 0);  if (!yy_VerbatimChunk(G)) { goto l1446; }
+  yyprintf((stderr, "%s\n", "Verbatim"));  if (!(YY_BEGIN)) goto l1446;  if (!yy_LocMarker(G)) { goto l1446; }  yyDo(G, yySet, -1, 0);  if (!yy_VerbatimChunk(G)) { goto l1446; }
   l1447:;	
   {  int yypos1448= G->pos, yythunkpos1448= G->thunkpos;  if (!yy_VerbatimChunk(G)) { goto l1448; }  goto l1447;
   l1448:;	  G->pos= yypos1448; G->thunkpos= yythunkpos1448;
-  }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1446;  yyDo(G, yy_1_Verbatim, G->begin, G->end);
+  }  if (!(YY_END)) goto l1446;  yyDo(G, yy_1_Verbatim, G->begin, G->end);
   yyprintf((stderr, "  ok   %s @ %s\n", "Verbatim", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
   l1446:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
@@ -6400,7 +8845,7 @@ YY_RULE(int) yy_LocMarker(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "LocMarker", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_Block(GREG *G)
+YY_RULE(int) yy_Block_unbudgeted(GREG *G)
 {  int yypos0= G->pos, yythunkpos0= G->thunkpos;
   yyprintf((stderr, "%s\n", "Block"));
   l1454:;	
@@ -6517,18 +8962,141 @@ YY_PARSE(void) YY_NAME(parse_free)(GREG *G)
  */
 
 
+/*
+Parser context of the thread
+
+Every parse of a text runs the parser several times: once for the
+references, once for the document, and once more for every list item and
+blockquote. Their greg state and memo come from one context, which is
+reset rather than freed between the runs. It stays with the thread for
+the next parse, unless it has grown beyond pmh_CONTEXT_MAX_KEPT bytes;
+pmh_free_thread_context() frees it. A parse started while the one of the
+thread is in use (from a cancellation callback) gets a context of its own.
+*/
+
+#ifndef pmh_CONTEXT_MAX_KEPT
+#define pmh_CONTEXT_MAX_KEPT (16 * 1024 * 1024)
+#endif
+
+static pmh_THREAD_LOCAL pmh_parse_context *thread_context = NULL;
+
+/* The first power of two times `size` that is at least `min_size` */
+static unsigned long grown_size(unsigned long size, unsigned long min_size)
+{
+    while (size < min_size)
+        size *= 2;
+    return size;
+}
+
+/* A context for a parse of a text of `text_len` characters */
+static pmh_parse_context *acquire_context(unsigned long text_len)
+{
+    pmh_parse_context *context = thread_context;
+    if (context == NULL || context->in_use) {
+        context = (pmh_parse_context *)malloc(sizeof(pmh_parse_context));
+        context->G = YY_NAME(parse_new)(NULL);
+        context->memo = NULL;
+        if (thread_context == NULL)
+            thread_context = context;
+    }
+    context->in_use = true;
+    
+    GREG *G = context->G;
+    if (G->buflen == 0) {
+        G->buflen = YY_BUFFER_START_SIZE;
+        G->buf = (char *)YY_ALLOC(G->buflen, G->data);
+        G->textlen = YY_BUFFER_START_SIZE;
+        G->text = (char *)YY_ALLOC(G->textlen, G->data);
+        G->thunkslen = YY_STACK_SIZE;
+        G->thunks = (yythunk *)YY_ALLOC(sizeof(yythunk) * G->thunkslen,
+                                        G->data);
+        G->valslen = YY_STACK_SIZE;
+        G->vals = (YYSTYPE *)YY_ALLOC(sizeof(YYSTYPE) * G->valslen, G->data);
+    }
+    
+    // A run keeps all its input in the buffer until it ends, with 512 bytes
+    // to spare for yyrefill(), and leaves about a thunk for every eight
+    // characters. Nothing is kept in them between runs, so they are not
+    // reallocated but allocated anew:
+    unsigned long buflen = grown_size(G->buflen, text_len + 512);
+    if (buflen != (unsigned long)G->buflen) {
+        YY_FREE(G->buf);
+        G->buflen = (int)buflen;
+        G->buf = (char *)YY_ALLOC(G->buflen, G->data);
+    }
+    unsigned long thunkslen = grown_size(G->thunkslen, text_len / 8);
+    if (thunkslen != (unsigned long)G->thunkslen) {
+        YY_FREE(G->thunks);
+        G->thunkslen = (int)thunkslen;
+        G->thunks = (yythunk *)YY_ALLOC(sizeof(yythunk) * G->thunkslen,
+                                        G->data);
+    }
+    return context;
+}
+
+static size_t context_size(pmh_parse_context *context)
+{
+    GREG *G = context->G;
+    size_t size = G->buflen + G->textlen + sizeof(yythunk) * G->thunkslen
+                  + sizeof(YYSTYPE) * G->valslen;
+    if (context->memo != NULL)
+        size += context->memo->bytes;
+    return size;
+}
+
+static void free_context(pmh_parse_context *context)
+{
+    YY_NAME(parse_free)(context->G);
+    if (context->memo != NULL)
+        free_memo(context->memo);
+    free(context);
+}
+
+static void release_context(pmh_parse_context *context)
+{
+    context->in_use = false;
+    if (context != thread_context)
+        free_context(context);
+    else if (context_size(context) > pmh_CONTEXT_MAX_KEPT)
+        pmh_free_thread_context();
+}
+
+void pmh_free_thread_context(void)
+{
+    if (thread_context != NULL && !thread_context->in_use) {
+        free_context(thread_context);
+        thread_context = NULL;
+    }
+}
+
+
 static void _parse(parser_data *p_data, yyrule start_rule)
 {
-    GREG *g = YY_NAME(parse_new)(p_data);
+    pmh_parse_context *context = p_data->context;
+    if (extension(p_data, pmh_EXT_MEMOIZE)) {
+        if (context->memo == NULL)
+            context->memo = mk_memo();
+        else
+            reset_memo(context->memo);
+        p_data->memo = context->memo;
+    }
+    
+    // Start over, with what is left in the buffers from the last run
+    // thrown away:
+    GREG *g = context->G;
+    g->data = p_data;
+    g->offset = g->limit = 0;
     if (start_rule == NULL)
         YY_NAME(parse)(g);
     else
         YY_NAME(parse_from)(g, start_rule);
-    YY_NAME(parse_free)(g);
+    g->data = NULL;
+    p_data->memo = NULL;
     
     pmh_PRINTF("\n\n");
 }
 
+
 static void parse_markdown(parser_data *p_data)
 {
     pmh_PRINTF("\nPARSING DOCUMENT: ");
@@ -6546,5 +9114,6 @@ static void parse_references(parser_data *p_data)
     
     p_data->references = p_data->head_elems[pmh_REFERENCE];
     p_data->head_elems[pmh_REFERENCE] = NULL;
+    build_reference_table(p_data);
 }
 
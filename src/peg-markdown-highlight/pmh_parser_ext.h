@@ -0,0 +1,406 @@
+/* PEG Markdown Highlight
+ * Copyright 2011-2016 Ali Rantakari -- http://hasseg.org
+ * Licensed under the GPL2+ and MIT licenses (see LICENSE for more info).
+ * 
+ * pmh_parser_ext.h
+ * 
+ * Additions of this project to the API of pmh_parser.h
+ */
+
+#ifndef pmh_MARKDOWN_PARSER_EXT
+#define pmh_MARKDOWN_PARSER_EXT
+
+#include "pmh_parser.h"
+
+/**
+\brief Memoize rules while parsing
+
+Not a syntax extension: set this in the `extensions` of a parse to have
+the parser remember the outcomes of the rules for emphasis, links and code
+spans. This keeps input with many unclosed brackets or emphasis markers
+from taking exponential time, at the cost of up to pmh_MEMO_BUDGET bytes
+(16 MB unless defined otherwise when compiling pmh_parser.c).
+*/
+#define pmh_EXT_MEMOIZE (1 << 16)
+
+/**
+\brief Report offsets in UTF-16 code units
+
+Not a syntax extension: set this in the `extensions` of a parse of UTF-8
+to have the offsets of the elements and of the unparsed ranges count
+UTF-16 code units rather than characters, so that they are positions in
+the same text held in UTF-16 (such as in a QString or an NSString). The
+two differ after characters outside of the BMP, such as emoji, which take
+two code units each. An index of those is built once per parse, which
+maps each offset with a binary search. The offsets of the UTF-16 parse
+functions count code units already, with or without this.
+*/
+#define pmh_EXT_UTF16_OFFSETS (1 << 17)
+
+/**
+\brief Cancellation callback
+
+Polled by the parser while it runs. Returning true abandons the parse.
+It is called from the parsing thread, so it must be thread safe with
+respect to whoever requests the cancellation (e.g. by reading an atomic
+flag).
+
+\param[in]  context  The context pointer given to the parser.
+*/
+typedef bool (*pmh_cancel_callback)(void *context);
+
+/**
+\brief Parse Markdown text, return elements, unless cancelled
+
+Same as pmh_markdown_to_elements(), but polls `cancel` while parsing: every
+few thousand characters of input or steps of the parser, and before each
+postprocessing parse of raw blocks. As soon as it returns true, parsing stops, all elements are
+freed and `*out_result` is set to NULL.
+
+\param[in]  text            The Markdown text to parse for highlighting.
+\param[in]  extensions      The extensions to use in parsing (a bitfield
+                            of pmh_extensions values).
+\param[in]  cancel          The cancellation callback, or NULL.
+\param[in]  cancel_context  Passed to `cancel`.
+\param[out] out_result      A pmh_element array, indexed by type, containing
+                            the results of the parsing (linked lists of
+                            elements). You must pass this to
+                            pmh_free_elements() when it's not needed anymore.
+
+\return false if the parse was cancelled.
+
+\sa pmh_markdown_to_elements
+*/
+bool pmh_markdown_to_elements_cancellable(char *text, int extensions,
+                                          pmh_cancel_callback cancel,
+                                          void *cancel_context,
+                                          pmh_element **out_result[]);
+
+/**
+\brief Limits of a parse
+
+A field of 0 sets no limit. A step is an attempt of the parser at a block,
+or at emphasis, a link or a code span at some position. Backtracking over
+the same text takes these steps again, so their number bounds the work
+also where the parser reads little input.
+*/
+typedef struct
+{
+    unsigned long max_steps;  /**< Most steps to take */
+    unsigned long max_msecs;  /**< Most milliseconds to take, by the clock */
+} pmh_parse_budget;
+
+/**
+\brief A range of the input left unparsed
+
+The offsets are counted like those of pmh_element.
+*/
+typedef struct pmh_Range
+{
+    unsigned long pos;
+    unsigned long end;
+    struct pmh_Range *next;
+} pmh_range;
+
+/**
+\brief Parse Markdown text within a budget, return elements, unless cancelled
+
+Same as pmh_markdown_to_elements_cancellable(), but stops parsing when the
+budget runs out. The elements of the blocks parsed completely until then
+are returned as usual, and `*out_unparsed` is set to a list of the ranges
+of text whose elements are missing. These are in no particular order. The
+text in them may still be covered by elements of enclosing blocks, such as
+a blockquote whose content was not parsed.
+
+\param[in]  text            The Markdown text to parse for highlighting.
+\param[in]  extensions      The extensions to use in parsing (a bitfield
+                            of pmh_extensions values).
+\param[in]  budget          Limits of the parse, or NULL for none.
+\param[in]  cancel          The cancellation callback, or NULL.
+\param[in]  cancel_context  Passed to `cancel`.
+\param[out] out_result      A pmh_element array, indexed by type, containing
+                            the results of the parsing (linked lists of
+                            elements). You must pass this to
+                            pmh_free_elements() when it's not needed anymore.
+\param[out] out_unparsed    The ranges left unparsed, NULL if there are
+                            none. They are freed by pmh_free_elements()
+                            together with the result. May be NULL.
+
+\return false if the parse was cancelled.
+
+\sa pmh_markdown_to_elements_cancellable
+*/
+bool pmh_markdown_to_elements_budgeted(char *text, int extensions,
+                                       const pmh_parse_budget *budget,
+                                       pmh_cancel_callback cancel,
+                                       void *cancel_context,
+                                       pmh_element **out_result[],
+                                       pmh_range **out_unparsed);
+
+/**
+\brief Parse Markdown text on several threads, return elements, unless
+       cancelled
+
+Same as pmh_markdown_to_elements_budgeted(), but parses long texts in
+chunks on up to `num_threads` threads, the calling one included. The
+chunks are cut only where the text parses the same in pieces as it does in
+the whole, so the elements are the same as those of a parse on one thread,
+if in other orders in their lists. Short texts, and texts with nowhere to
+cut, are parsed on the calling thread.
+
+The other threads come from a pool shared by all parses in the process:
+they are started as parses first ask for them (64 at most) and kept for
+the parses to come, so that parses on several threads at once share them.
+
+The reference definitions are found on the calling thread first. Then
+each chunk is parsed within what is left of the budget: the deadline
+holds for all of them together, but steps are counted in each chunk on its
+own. `cancel` is polled by all the threads, so it may be called from
+several of them at once.
+
+\param[in]  text            The Markdown text to parse for highlighting.
+\param[in]  extensions      The extensions to use in parsing (a bitfield
+                            of pmh_extensions values).
+\param[in]  num_threads     The most threads to parse on (1 or less for
+                            just the calling one).
+\param[in]  budget          Limits of the parse, or NULL for none.
+\param[in]  cancel          The cancellation callback, or NULL.
+\param[in]  cancel_context  Passed to `cancel`.
+\param[out] out_result      A pmh_element array, indexed by type, containing
+                            the results of the parsing (linked lists of
+                            elements). You must pass this to
+                            pmh_free_elements() when it's not needed anymore.
+\param[out] out_unparsed    The ranges left unparsed, NULL if there are
+                            none. They are freed by pmh_free_elements()
+                            together with the result. May be NULL.
+
+\return false if the parse was cancelled.
+
+\sa pmh_markdown_to_elements_budgeted
+*/
+bool pmh_markdown_to_elements_parallel(char *text, int extensions,
+                                       int num_threads,
+                                       const pmh_parse_budget *budget,
+                                       pmh_cancel_callback cancel,
+                                       void *cancel_context,
+                                       pmh_element **out_result[],
+                                       pmh_range **out_unparsed);
+
+/**
+\brief Parse Markdown text in a buffer, return elements, unless cancelled
+
+Same as pmh_markdown_to_elements_parallel(), but takes the text as `len`
+bytes at `data`, which need not be NUL-terminated and are neither written
+to nor read past: the text may be in read-only memory, such as a mapped
+file or a snapshot shared with other threads. A NUL byte among them ends
+the text early. Nothing of the text is copied if it is all ASCII. A byte
+that is not part of valid UTF-8 counts as a character of its own, as it
+decodes to a U+FFFD of its own in a QString.
+
+\param[in]  data            The Markdown text to parse for highlighting,
+                            in UTF-8.
+\param[in]  len             The length of the text in bytes.
+\param[in]  extensions      The extensions to use in parsing (a bitfield
+                            of pmh_extensions values).
+\param[in]  num_threads     The most threads to parse on (1 or less for
+                            just the calling one).
+\param[in]  budget          Limits of the parse, or NULL for none.
+\param[in]  cancel          The cancellation callback, or NULL.
+\param[in]  cancel_context  Passed to `cancel`.
+\param[out] out_result      A pmh_element array, indexed by type, containing
+                            the results of the parsing (linked lists of
+                            elements). You must pass this to
+                            pmh_free_elements() when it's not needed anymore.
+\param[out] out_unparsed    The ranges left unparsed, NULL if there are
+                            none. They are freed by pmh_free_elements()
+                            together with the result. May be NULL.
+
+\return false if the parse was cancelled.
+
+\sa pmh_markdown_to_elements_parallel
+*/
+bool pmh_markdown_buffer_to_elements(const char *data, size_t len,
+                                     int extensions, int num_threads,
+                                     const pmh_parse_budget *budget,
+                                     pmh_cancel_callback cancel,
+                                     void *cancel_context,
+                                     pmh_element **out_result[],
+                                     pmh_range **out_unparsed);
+
+/**
+\brief Parse Markdown text in UTF-16, return elements, unless cancelled
+
+Same as pmh_markdown_buffer_to_elements(), but takes the text as `len`
+UTF-16 code units at `data`, as a QString or a wchar_t string on Windows
+holds it, with no transcoding to UTF-8 first. Element offsets count code
+units (a surrogate pair counts two), so they are positions in the same
+UTF-16 text. Characters outside of ASCII are only ever text to Markdown,
+and are parsed as such. Strings of elements, such as the addresses of
+links, are in UTF-8.
+
+\param[in]  data            The Markdown text to parse for highlighting,
+                            in UTF-16, in the byte order of the machine.
+\param[in]  len             The length of the text in code units.
+\param[in]  extensions      The extensions to use in parsing (a bitfield
+                            of pmh_extensions values).
+\param[in]  num_threads     The most threads to parse on (1 or less for
+                            just the calling one).
+\param[in]  budget          Limits of the parse, or NULL for none.
+\param[in]  cancel          The cancellation callback, or NULL.
+\param[in]  cancel_context  Passed to `cancel`.
+\param[out] out_result      A pmh_element array, indexed by type, containing
+                            the results of the parsing (linked lists of
+                            elements). You must pass this to
+                            pmh_free_elements() when it's not needed anymore.
+\param[out] out_unparsed    The ranges left unparsed, NULL if there are
+                            none. They are freed by pmh_free_elements()
+                            together with the result. May be NULL.
+
+\return false if the parse was cancelled.
+
+\sa pmh_markdown_buffer_to_elements
+*/
+bool pmh_markdown_utf16_to_elements(const unsigned short *data, size_t len,
+                                    int extensions, int num_threads,
+                                    const pmh_parse_budget *budget,
+                                    pmh_cancel_callback cancel,
+                                    void *cancel_context,
+                                    pmh_element **out_result[],
+                                    pmh_range **out_unparsed);
+
+/**
+\brief Flag of a flat element with a link address
+
+Set in pmh_flat_elements::flags where address_pos and address_end hold the
+range of the address.
+*/
+#define pmh_FLAT_ADDRESS (1 << 0)
+
+/**
+\brief Parse result in flat arrays
+
+Holds the same elements as the linked lists of pmh_markdown_to_elements(),
+of the language types only, as columns: element `i` has the type
+`types[i]`, the range `[pos[i], end[i])`, and `flags[i]`. The elements are
+sorted by position, then end, then type. `by_type` lists the indexes of
+the elements of each type, in the same order: those of type `t` are
+`by_type[type_start[t]]` up to (excluding) `by_type[type_start[t + 1]]`.
+
+Strings are not copied but given as ranges of the input text in bytes, or
+in code units for UTF-16 input (unlike `pos` and `end`, which count
+characters, or code units for UTF-16 input and with pmh_EXT_UTF16_OFFSETS):
+the address of a link is
+`[address_pos[i], address_end[i])` of the text if `flags[i]` has
+pmh_FLAT_ADDRESS set.
+
+The ranges the parse did not get to within its budget are given sorted and
+disjoint as `[unparsed_pos[j], unparsed_end[j])`.
+
+All of it is one block of memory, `bytes` long, which pmh_free_flat_elements()
+frees; so it is cheap to hand to another thread. The arrays follow the
+struct in the block, without gaps (the unsigned long ones first, then
+`by_type`, then `types` and `flags`), which makes them easy to write out;
+a copy of the block needs its pointers rebased.
+*/
+typedef struct
+{
+    size_t count;                 /**< Number of elements */
+    unsigned char *types;         /**< pmh_element_type of each element */
+    unsigned char *flags;         /**< pmh_FLAT_* flags of each element */
+    unsigned long *pos;           /**< Start of each element */
+    unsigned long *end;           /**< End of each element */
+    unsigned long *address_pos;   /**< Start of the address in the input */
+    unsigned long *address_end;   /**< End of the address in the input */
+    
+    size_t *by_type;              /**< Element indexes, grouped by type */
+    size_t type_start[pmh_NUM_LANG_TYPES + 1]; /**< Groups in by_type */
+    
+    size_t unparsed_count;        /**< Number of unparsed ranges */
+    unsigned long *unparsed_pos;  /**< Start of each unparsed range */
+    unsigned long *unparsed_end;  /**< End of each unparsed range */
+    
+    size_t bytes;                 /**< Size of the block of memory */
+} pmh_flat_elements;
+
+/**
+\brief Parse Markdown text within a budget, return flat elements, unless
+       cancelled
+
+Same as pmh_markdown_buffer_to_elements(), but returns the result in
+flat arrays rather than linked lists.
+
+\param[in]  data            The Markdown text to parse for highlighting,
+                            in UTF-8.
+\param[in]  len             The length of the text in bytes.
+\param[in]  extensions      The extensions to use in parsing (a bitfield
+                            of pmh_extensions values).
+\param[in]  num_threads     The most threads to parse on (1 or less for
+                            just the calling one).
+\param[in]  budget          Limits of the parse, or NULL for none.
+\param[in]  cancel          The cancellation callback, or NULL.
+\param[in]  cancel_context  Passed to `cancel`.
+\param[out] out_result      The elements, NULL if cancelled. You must pass
+                            this to pmh_free_flat_elements() when it's not
+                            needed anymore.
+
+\return false if the parse was cancelled.
+
+\sa pmh_markdown_buffer_to_elements
+*/
+bool pmh_markdown_to_flat_elements(const char *data, size_t len,
+                                   int extensions, int num_threads,
+                                   const pmh_parse_budget *budget,
+                                   pmh_cancel_callback cancel,
+                                   void *cancel_context,
+                                   pmh_flat_elements **out_result);
+
+/**
+\brief Parse Markdown text in UTF-16 within a budget, return flat elements,
+       unless cancelled
+
+Same as pmh_markdown_utf16_to_elements(), but returns the result in flat
+arrays rather than linked lists, like pmh_markdown_to_flat_elements().
+
+\param[in]  data            The Markdown text to parse for highlighting,
+                            in UTF-16, in the byte order of the machine.
+\param[in]  len             The length of the text in code units.
+\param[in]  extensions      The extensions to use in parsing (a bitfield
+                            of pmh_extensions values).
+\param[in]  num_threads     The most threads to parse on (1 or less for
+                            just the calling one).
+\param[in]  budget          Limits of the parse, or NULL for none.
+\param[in]  cancel          The cancellation callback, or NULL.
+\param[in]  cancel_context  Passed to `cancel`.
+\param[out] out_result      The elements, NULL if cancelled. You must pass
+                            this to pmh_free_flat_elements() when it's not
+                            needed anymore.
+
+\return false if the parse was cancelled.
+
+\sa pmh_markdown_utf16_to_elements
+*/
+bool pmh_markdown_utf16_to_flat_elements(const unsigned short *data,
+                                         size_t len,
+                                         int extensions, int num_threads,
+                                         const pmh_parse_budget *budget,
+                                         pmh_cancel_callback cancel,
+                                         void *cancel_context,
+                                         pmh_flat_elements **out_result);
+
+/**
+\brief Free a result of pmh_markdown_to_flat_elements() or
+       pmh_markdown_utf16_to_flat_elements()
+*/
+void pmh_free_flat_elements(pmh_flat_elements *elems);
+
+/**
+\brief Free the parser context of the calling thread
+
+The buffers of the parser stay with each thread that parses, to be used
+again by its next parse. A thread should call this before it ends, or when
+it will not parse for a while. The threads of the pool that parallel parses
+share keep theirs (see pmh_markdown_to_elements_parallel()).
+*/
+void pmh_free_thread_context(void);
+
+#endif
@@ -23,4 +23,5 @@ HEADERS  += \
 #
 # peg-markdown-highlight
 #
+INCLUDEPATH += $$PWD/..
 INCLUDEPATH += $$PWD/../../3rdparty/peg-markdown-highlight.git
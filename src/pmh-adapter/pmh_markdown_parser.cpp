@@ -22,7 +22,7 @@
 extern "C" {
 #endif
 #   include <pmh_definitions.h>
-#   include <pmh_parser.h>
+#   include <peg-markdown-highlight/pmh_parser_ext.h>
 #ifdef __cplusplus
 }
 #endif
@@ -32,27 +32,30 @@ extern "C" {
 QMap<MarkdownElement::Type, QList<MarkdownElement> > PmhMarkdownParser::parseMarkdown(const QString &text)
 {
     // parse markdown and generate syntax elements
-    pmh_element **elements;
-    pmh_markdown_to_elements(text.toUtf8().data(), pmh_EXT_NONE, &elements);
-
     QMap<MarkdownElement::Type, QList<MarkdownElement> > elementMap;
+    pmh_flat_elements *elements = NULL;
+    if (!pmh_markdown_utf16_to_flat_elements(text.utf16(), text.length(), pmh_EXT_NONE, 1,
+                                             NULL, NULL, NULL, &elements)
+            || elements == NULL)
+        return elementMap;
+
     for (int i = 0; i < pmh_NUM_LANG_TYPES; i++) {
-        if (elements[i] != NULL) {
+        if (elements->type_start[i] != elements->type_start[i + 1]) {
             MarkdownElement::Type type = (MarkdownElement::Type)i;
             QList<MarkdownElement> list;
 
-            pmh_element *element = elements[i];
-            while (element != NULL) {
+            for (size_t j = elements->type_start[i]; j < elements->type_start[i + 1]; j++) {
+                size_t index = elements->by_type[j];
                 MarkdownElement e;
                 e.type = type;
-                e.start = element->pos;
-                e.end = element->end;
+                e.start = elements->pos[index];
+                e.end = elements->end[index];
                 list.append(e);
-                element = element->next;
             }
             elementMap[type] = list;
         }
     }
+    pmh_free_flat_elements(elements);
     return elementMap;
 }
 
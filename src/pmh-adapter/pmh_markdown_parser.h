@@ -52,13 +52,15 @@ public:
     };
     
     Type type;
-    unsigned long start;
+    unsigned long start;    // offsets in UTF-16 code units, i.e. QString positions
     unsigned long end;
 };
 
 class PmhMarkdownParser
 {
 public:
+    // The elements of each type are sorted by position (start, then end);
+    // the map is empty if the text could not be parsed
     QMap<MarkdownElement::Type, QList<MarkdownElement> > parseMarkdown(const QString &text);
 };
 
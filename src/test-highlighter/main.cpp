@@ -0,0 +1,32 @@
+﻿
+#include <QCoreApplication>
+#include <QtTest>
+
+#include "test_pmh_parser.h"
+#include "test_incremental_parser.h"
+#include "test_changed_range.h"
+#include "test_parser_threads.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    int ret = 0;
+    {
+        mdtextedit::TestPmhParser test;
+        ret |= QTest::qExec(&test, argc, argv);
+    }
+    {
+        mdtextedit::TestIncrementalParser test;
+        ret |= QTest::qExec(&test, argc, argv);
+    }
+    {
+        mdtextedit::TestChangedRange test;
+        ret |= QTest::qExec(&test, argc, argv);
+    }
+    {
+        mdtextedit::TestParserThreads test;
+        ret |= QTest::qExec(&test, argc, argv);
+    }
+    return ret;
+}
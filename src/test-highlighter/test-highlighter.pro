@@ -0,0 +1,26 @@
+
+TARGET = test-highlighter
+TEMPLATE = app
+
+include(../global.pri)
+
+QT += core gui testlib
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+CONFIG += testcase console
+CONFIG -= app_bundle
+
+# 头文件
+HEADERS += $$files(*.h*, true)
+
+# 源文件
+SOURCES += $$files(*.c*, true)
+
+# markdown-textedit
+HEADERS += ../markdown-textedit/highlighter/incremental_parser.h
+SOURCES += ../markdown-textedit/highlighter/incremental_parser.cpp
+
+# peg-markdown-highlight
+INCLUDEPATH += $$PWD/..
+INCLUDEPATH += $$PWD/../../3rdparty/peg-markdown-highlight.git
+LIBS += -L$$OUT_PWD/../peg-markdown-highlight$${OUT_TAIL} -lpmh
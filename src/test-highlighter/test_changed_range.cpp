@@ -0,0 +1,106 @@
+﻿
+#include <QtTest>
+
+#include <markdown-textedit/highlighter/incremental_parser.h>
+
+#include "test_changed_range.h"
+
+namespace mdtextedit
+{
+
+static HighlightElement element(pmh_element_type type, unsigned long pos, unsigned long end)
+{
+    HighlightElement e;
+    e.type = type;
+    e.pos = pos;
+    e.end = end;
+    return e;
+}
+
+void TestChangedRange::empty_document()
+{
+    const HighlightElements none;
+    long begin = -1, end = -1;
+    QVERIFY(!changed_range(none, 0, none, 0, TextChange(0, 0, 0), &begin, &end));
+
+    // typing into it changes the typed text only
+    QVERIFY(changed_range(none, 0, none, 0, TextChange(0, 0, 1), &begin, &end));
+    QCOMPARE(begin, 0L);
+    QCOMPARE(end, 1L);
+
+    HighlightElements emph;
+    emph.append(element(pmh_EMPH, 0, 3));
+    QVERIFY(changed_range(none, 0, emph, 0, TextChange(0, 0, 3), &begin, &end));
+    QCOMPARE(begin, 0L);
+    QCOMPARE(end, 3L);
+
+    // and emptying it the formerly formatted text
+    QVERIFY(changed_range(emph, 0, none, 0, TextChange(0, 3, 0), &begin, &end));
+    QCOMPARE(begin, 0L);
+    QCOMPARE(end, 0L);
+}
+
+void TestChangedRange::edit_at_start()
+{
+    HighlightElements older;
+    older.append(element(pmh_EMPH, 0, 5));
+    older.append(element(pmh_STRONG, 10, 20));
+
+    // elements behind the edit are only shifted
+    HighlightElements newer;
+    newer.append(element(pmh_EMPH, 2, 7));
+    newer.append(element(pmh_STRONG, 12, 22));
+    long begin = -1, end = -1;
+    QVERIFY(changed_range(older, 0, newer, 0, TextChange(0, 0, 2), &begin, &end));
+    QCOMPARE(begin, 0L);
+    QCOMPARE(end, 2L);
+
+    // an element the edit reaches into differs up to its end
+    newer[0] = element(pmh_EMPH, 0, 7);
+    QVERIFY(changed_range(older, 0, newer, 0, TextChange(0, 0, 2), &begin, &end));
+    QCOMPARE(begin, 0L);
+    QCOMPARE(end, 7L);
+}
+
+void TestChangedRange::edit_at_end()
+{
+    HighlightElements older;
+    older.append(element(pmh_EMPH, 0, 5));
+    older.append(element(pmh_CODE, 15, 20));
+
+    // appended text, and an element for it
+    HighlightElements newer = older;
+    newer.append(element(pmh_STRONG, 20, 25));
+    long begin = -1, end = -1;
+    QVERIFY(changed_range(older, 0, newer, 0, TextChange(20, 0, 5), &begin, &end));
+    QCOMPARE(begin, 20L);
+    QCOMPARE(end, 25L);
+
+    // the last element cut short
+    newer = older;
+    newer.last().end = 18;
+    QVERIFY(changed_range(older, 0, newer, 0, TextChange(18, 2, 0), &begin, &end));
+    QCOMPARE(begin, 15L);
+    QCOMPARE(end, 18L);
+}
+
+void TestChangedRange::whole_document_replaced()
+{
+    HighlightElements older;
+    older.append(element(pmh_EMPH, 0, 5));
+    older.append(element(pmh_STRONG, 10, 20));
+
+    HighlightElements newer;
+    newer.append(element(pmh_LINK, 3, 30));
+    long begin = -1, end = -1;
+    QVERIFY(changed_range(older, 0, newer, 0, TextChange(0, 20, 30), &begin, &end));
+    QCOMPARE(begin, 0L);
+    QCOMPARE(end, 30L);
+
+    // even with the same text and elements, as setPlainText() does
+    QVERIFY(changed_range(older, 0, older, 0, TextChange(0, 20, 20), &begin, &end));
+    QCOMPARE(begin, 0L);
+    QCOMPARE(end, 20L);
+}
+
+}
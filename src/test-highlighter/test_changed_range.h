@@ -0,0 +1,22 @@
+﻿#ifndef ___HEADFILE_10BAB045_E437_4B81_AA4C_9275DEAAC906_
+#define ___HEADFILE_10BAB045_E437_4B81_AA4C_9275DEAAC906_
+
+#include <QObject>
+
+namespace mdtextedit
+{
+
+class TestChangedRange : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void empty_document();
+    void edit_at_start();
+    void edit_at_end();
+    void whole_document_replaced();
+};
+
+}
+
+#endif
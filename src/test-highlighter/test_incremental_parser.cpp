@@ -0,0 +1,198 @@
+﻿
+#include <QtTest>
+
+#include <markdown-textedit/highlighter/incremental_parser.h>
+
+#include "test_incremental_parser.h"
+
+namespace mdtextedit
+{
+
+/**
+ * An edit made where 'anchor' occurs behind the middle of the document
+ */
+struct Edit
+{
+    const char *anchor;
+    int offset;         // of the edit from the anchor
+    int removed;
+    const char *added;
+};
+
+// Long enough to be parsed incrementally, with the kinds of blocks the
+// parsed region is expanded over
+static QString make_document()
+{
+    QString text;
+    for (int i = 0; text.length() < 64 * 1024; ++i)
+    {
+        text += QString("# Section %1\n\n").arg(i);
+        text += "A paragraph with *emphasis*, a [link][home] and `code`\n"
+                "that goes on in a second line.\n\n"
+                "- first item\n"
+                "- second item\n\n"
+                "    continued in the second item\n\n"
+                "> a quote\n"
+                "> going on\n\n"
+                "    verbatim text\n\n";
+    }
+    text += "[home]: http://example.com \"Home\"\n";
+    return text;
+}
+
+static QString difference(const HighlightElements& elements, const HighlightElements& expected)
+{
+    for (int i = 0; i < elements.size() && i < expected.size(); ++i)
+    {
+        const HighlightElement& e = elements.at(i), & x = expected.at(i);
+        if (e.type != x.type || e.pos != x.pos || e.end != x.end || e.address != x.address)
+            return QString("element %1 is type %2 at [%3, %4) instead of type %5 at [%6, %7)")
+                .arg(i).arg(e.type).arg(e.pos).arg(e.end).arg(x.type).arg(x.pos).arg(x.end);
+    }
+    if (elements.size() != expected.size())
+        return QString("%1 elements instead of %2").arg(elements.size()).arg(expected.size());
+    return QString();
+}
+
+/**
+ * Make each edit to the document on its own, and compare the incremental
+ * parse with a full one; returns what differs
+ */
+static QString check_edits(const Edit *edits, int count)
+{
+    const QString text = make_document();
+    for (int i = 0; i < count; ++i)
+    {
+        const Edit& edit = edits[i];
+        const int position = text.indexOf(QLatin1String(edit.anchor), text.length() / 2) +
+            edit.offset;
+        QString edited = text;
+        edited.replace(position, edit.removed, QString(edit.added));
+        const TextChange change(position, edit.removed, QString(edit.added).length());
+
+        IncrementalParser parser, full;
+        parser.parse(text, TextChange());
+        if (parser.is_full_parse(edited, change))
+            return QString("edit %1 is not parsed incrementally").arg(i);
+        parser.parse(edited, change);
+        full.parse(edited, TextChange());
+
+        const QString diff = difference(parser.elements(), full.elements());
+        if (!diff.isEmpty())
+            return QString("edit %1: %2").arg(i).arg(diff);
+    }
+    return QString();
+}
+
+void TestIncrementalParser::merge_folds_later_edits()
+{
+    // typing
+    TextChange change(5, 0, 1);
+    change.merge(TextChange(6, 0, 1));
+    QCOMPARE(change.position, 5);
+    QCOMPARE(change.removed, 0);
+    QCOMPARE(change.added, 2);
+
+    // backspace over typed text
+    change = TextChange(5, 0, 3);
+    change.merge(TextChange(6, 2, 0));
+    QCOMPARE(change.position, 5);
+    QCOMPARE(change.removed, 0);
+    QCOMPARE(change.added, 1);
+
+    // an edit in front of the first one; [3, 12) of the original text
+    // becomes [3, 14)
+    change = TextChange(10, 2, 0);
+    change.merge(TextChange(3, 0, 4));
+    QCOMPARE(change.position, 3);
+    QCOMPARE(change.removed, 9);
+    QCOMPARE(change.added, 11);
+
+    // an edit behind the first one, overlapping it
+    change = TextChange(2, 1, 3);
+    change.merge(TextChange(4, 4, 0));
+    QCOMPARE(change.position, 2);
+    QCOMPARE(change.removed, 4);
+    QCOMPARE(change.added, 2);
+}
+
+void TestIncrementalParser::merge_keeps_full_and_drops_empty()
+{
+    TextChange change;
+    change.merge(TextChange(3, 1, 1));
+    QVERIFY(change.is_full());
+
+    change = TextChange(3, 1, 1);
+    change.merge(TextChange());
+    QVERIFY(change.is_full());
+
+    change = TextChange(0, 0, 0);
+    change.merge(TextChange(3, 1, 2));
+    QCOMPARE(change.position, 3);
+    QCOMPARE(change.removed, 1);
+    QCOMPARE(change.added, 2);
+
+    change.merge(TextChange(0, 0, 0));
+    QCOMPARE(change.position, 3);
+    QCOMPARE(change.removed, 1);
+    QCOMPARE(change.added, 2);
+}
+
+void TestIncrementalParser::edits_inside_blocks_match_full_parse()
+{
+    const Edit edits[] = {
+        {"emphasis", 3, 0, "x"},
+        {"second line", 0, 0, "*"},
+        {"link]", 0, 1, ""},
+        {"continued in", 0, 0, "**bold** "},
+        {"verbatim text", 0, 0, "*not emphasis* "},
+        {"going on", 0, 5, ""},
+    };
+    const QString diff = check_edits(edits, sizeof(edits) / sizeof(edits[0]));
+    QVERIFY2(diff.isEmpty(), qPrintable(diff));
+}
+
+void TestIncrementalParser::edits_across_blocks_match_full_parse()
+{
+    const Edit edits[] = {
+        // split a paragraph, and start a heading in it
+        {"that goes on", 0, 0, "\n"},
+        {"that goes on", 0, 0, "## Heading\n"},
+        // join list items with the text behind them
+        {"    continued in", -1, 1, ""},
+        {"> a quote", -1, 1, ""},
+        // a quote turning into a paragraph, and code into a list item
+        {"> going on", 0, 2, ""},
+        {"    verbatim text", 0, 4, "- "},
+        // from a paragraph into a list
+        {"second line", 0, 30, ""},
+    };
+    const QString diff = check_edits(edits, sizeof(edits) / sizeof(edits[0]));
+    QVERIFY2(diff.isEmpty(), qPrintable(diff));
+}
+
+void TestIncrementalParser::edit_at_top_scans_enclosing_blocks_only()
+{
+    const QString text = make_document();
+    const int position = text.indexOf(QLatin1String("emphasis"));
+    QString edited = text;
+    edited.replace(position, 0, QString("x"));
+
+    IncrementalParser parser, full;
+    parser.parse(text, TextChange());
+    parser.parse(edited, TextChange(position, 0, 1));
+    full.parse(edited, TextChange());
+
+    // the paragraph and the lines around it, none of the sections behind
+    int begin = 0, end = 0;
+    parser.scanned_range(&begin, &end);
+    const int next_section = edited.indexOf(QLatin1String("# Section 1"));
+    QVERIFY2(begin <= position && position < end && end <= next_section,
+             qPrintable(QString("scanned [%1, %2) for an edit at %3, the next section is at %4")
+                        .arg(begin).arg(end).arg(position).arg(next_section)));
+
+    const QString diff = difference(parser.elements(), full.elements());
+    QVERIFY2(diff.isEmpty(), qPrintable(diff));
+}
+
+}
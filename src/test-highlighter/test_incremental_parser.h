@@ -0,0 +1,23 @@
+﻿#ifndef ___HEADFILE_BCCDB1B7_7FB8_4A61_BC49_785BFEEB641C_
+#define ___HEADFILE_BCCDB1B7_7FB8_4A61_BC49_785BFEEB641C_
+
+#include <QObject>
+
+namespace mdtextedit
+{
+
+class TestIncrementalParser : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void merge_folds_later_edits();
+    void merge_keeps_full_and_drops_empty();
+    void edits_inside_blocks_match_full_parse();
+    void edits_across_blocks_match_full_parse();
+    void edit_at_top_scans_enclosing_blocks_only();
+};
+
+}
+
+#endif
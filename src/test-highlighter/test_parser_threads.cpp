@@ -0,0 +1,221 @@
+﻿
+#include <QtTest>
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#   include <peg-markdown-highlight/pmh_parser_ext.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include "test_parser_threads.h"
+
+#define NUM_DOCS        6
+#define NUM_MODES       5
+#define NUM_THREADS     8
+#define NUM_PARSES      4
+#define PARSE_THREADS   4
+
+// Long enough for the parallel parses to cut it into chunks:
+#define LONG_DOC_LEN    (200 * 1024)
+#define SHORT_DOC_LEN   (4 * 1024)
+
+#define EXTENSIONS  (pmh_EXT_NOTES | pmh_EXT_STRIKE | pmh_EXT_MEMOIZE)
+
+namespace mdtextedit
+{
+
+static const char *fragments[] = {
+    "Para text *emph* and **strong** `code` ~~strike~~.\n",
+    "Another line with [link](http://x.com \"title\") here.\n",
+    "[ref]: http://ref.com \"Ref Title\"\n",
+    "[ref] and [other][ref] and ![img](a.png)\n",
+    "<div>\n\nInside div\n\n</div>\n",
+    "- item 1\n- item 2\n\n    continued\n",
+    "> quote\n> more\n",
+    "    code line\n",
+    "# Heading\n\n## Sub\n",
+    "中文 *强调* 和 [链接](http://例子.com) 😀 emoji 𝄞\n",
+    "http://auto.link and <me@mail.com>\n",
+    "[a [a [a [a *a **a `a unclosed\n",
+    "Footnote[^1] here.\n\n[^1]: The note.\n",
+    "\n",
+};
+
+struct Document
+{
+    QByteArray utf8;
+    QString utf16;
+};
+
+static unsigned int next_random(unsigned int *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (*seed >> 16) & 0x7fff;
+}
+
+static Document make_document(int d, int length)
+{
+    unsigned int seed = (unsigned int) d + 1;
+    const int num_fragments = sizeof(fragments) / sizeof(fragments[0]);
+    Document doc;
+    while (doc.utf8.size() < length)
+    {
+        doc.utf8 += fragments[next_random(&seed) % num_fragments];
+        if (next_random(&seed) % 3 == 0)
+            doc.utf8 += '\n';
+    }
+    doc.utf16 = QString::fromUtf8(doc.utf8);
+    return doc;
+}
+
+static unsigned long hash_flat(const pmh_flat_elements *flat)
+{
+    unsigned long h = flat->count;
+    for (size_t i = 0; i < flat->count; ++i)
+    {
+        h = h * 31 + flat->pos[i] * 7 + flat->end[i] * 3 + flat->types[i];
+        if (flat->flags[i] & pmh_FLAT_ADDRESS)
+            h = h * 31 + flat->address_pos[i] + flat->address_end[i];
+    }
+    for (size_t i = 0; i < flat->unparsed_count; ++i)
+        h = h * 17 + flat->unparsed_pos[i] + flat->unparsed_end[i];
+    return h;
+}
+
+// Independent of the order of the lists, which parallel parses change
+static unsigned long hash_elements(pmh_element **result)
+{
+    unsigned long h = 0;
+    for (int type = 0; type < pmh_NUM_LANG_TYPES; ++type)
+    {
+        for (const pmh_element *e = result[type]; NULL != e; e = e->next)
+            h += (e->pos * 7 + e->end + type) * 2654435761UL
+                 + (NULL != e->address ? strlen(e->address) : 0)
+                 + (NULL != e->label ? strlen(e->label) : 0);
+    }
+    return h;
+}
+
+static bool never_cancel(void *context)
+{
+    return 0 != *static_cast<volatile int*>(context);
+}
+
+/**
+ * Parse the document in one of the ways to test, on up to 'num_threads'
+ * threads; 0 if the parse failed
+ */
+static unsigned long parse(const Document& doc, int mode, int num_threads)
+{
+    static int zero = 0;
+    pmh_flat_elements *flat = NULL;
+    pmh_element **result = NULL;
+    unsigned long h = 0;
+    switch (mode)
+    {
+    case 0:
+        if (pmh_markdown_to_flat_elements(doc.utf8.constData(), doc.utf8.size(),
+                                          EXTENSIONS, num_threads, NULL, NULL, NULL, &flat))
+            h = hash_flat(flat);
+        break;
+
+    case 1:
+        if (pmh_markdown_utf16_to_flat_elements(doc.utf16.utf16(), doc.utf16.size(),
+                                                EXTENSIONS, num_threads, NULL, NULL, NULL, &flat))
+            h = hash_flat(flat);
+        break;
+
+    case 2:
+        if (pmh_markdown_buffer_to_elements(doc.utf8.constData(), doc.utf8.size(),
+                                            EXTENSIONS | pmh_EXT_UTF16_OFFSETS, num_threads,
+                                            NULL, NULL, NULL, &result, NULL))
+            h = hash_elements(result);
+        break;
+
+    case 3:
+    {
+        pmh_parse_budget budget;
+        budget.max_steps = 0;
+        budget.max_msecs = 1000000;
+        if (pmh_markdown_to_flat_elements(doc.utf8.constData(), doc.utf8.size(),
+                                          EXTENSIONS, num_threads, &budget, NULL, NULL, &flat))
+            h = hash_flat(flat);
+        break;
+    }
+
+    default:
+        if (pmh_markdown_utf16_to_flat_elements(doc.utf16.utf16(), doc.utf16.size(),
+                                                EXTENSIONS, num_threads,
+                                                NULL, never_cancel, &zero, &flat))
+            h = hash_flat(flat);
+        break;
+    }
+    if (NULL != flat)
+        pmh_free_flat_elements(flat);
+    if (NULL != result)
+        pmh_free_elements(result);
+    return h;
+}
+
+static bool names_match_types()
+{
+    for (int type = 0; type < pmh_NUM_LANG_TYPES; ++type)
+    {
+        char *name = pmh_element_name_from_type((pmh_element_type) type);
+        if (0 != strcmp(name, "unknown type") && (int) pmh_element_type_from_name(name) != type)
+            return false;
+    }
+    return true;
+}
+
+void TestParserThreads::concurrent_parses_match_serial()
+{
+    std::vector<Document> docs;
+    unsigned long expected[NUM_DOCS][NUM_MODES];
+    for (int d = 0; d < NUM_DOCS; ++d)
+    {
+        docs.push_back(make_document(d, (d % 2 == 0) ? LONG_DOC_LEN : SHORT_DOC_LEN));
+        for (int mode = 0; mode < NUM_MODES; ++mode)
+            expected[d][mode] = parse(docs.back(), mode, 1);
+    }
+
+    std::mutex failures_mutex;
+    QStringList failures;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NUM_THREADS; ++i)
+    {
+        threads.push_back(std::thread([&, i] {
+            unsigned int seed = i + 1;
+            for (int j = 0; j < NUM_PARSES; ++j)
+            {
+                const int d = next_random(&seed) % NUM_DOCS;
+                const int mode = next_random(&seed) % NUM_MODES;
+                QString failure;
+                if (!names_match_types())
+                    failure = "type name lookup";
+                else if (parse(docs.at(d), mode, PARSE_THREADS) != expected[d][mode])
+                    failure = QString("result of document %1 in mode %2 differs from serial parse")
+                        .arg(d).arg(mode);
+                if (!failure.isEmpty())
+                {
+                    std::lock_guard<std::mutex> lock(failures_mutex);
+                    failures.append(failure);
+                }
+            }
+            pmh_free_thread_context();
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads.at(i).join();
+    pmh_free_thread_context();
+
+    QVERIFY2(failures.isEmpty(), qPrintable(failures.join("; ")));
+}
+
+}
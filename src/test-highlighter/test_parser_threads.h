@@ -0,0 +1,23 @@
+﻿#ifndef ___HEADFILE_54C74E65_B3ED_4331_8D52_5842751F5FF7_
+#define ___HEADFILE_54C74E65_B3ED_4331_8D52_5842751F5FF7_
+
+#include <QObject>
+
+namespace mdtextedit
+{
+
+/**
+ * Parses on many threads at once, in all the ways pmh_parser_ext.h offers;
+ * built with ThreadSanitizer, it reports the data races of the parser
+ */
+class TestParserThreads : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void concurrent_parses_match_serial();
+};
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+﻿
+#include <QtTest>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#   include <peg-markdown-highlight/pmh_parser_ext.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include "test_pmh_parser.h"
+
+namespace mdtextedit
+{
+
+static bool parses_within(const QByteArray& text, unsigned long max_steps)
+{
+    pmh_parse_budget budget = { max_steps, 0 };
+    pmh_element **elements = NULL;
+    pmh_range *unparsed = NULL;
+    pmh_markdown_buffer_to_elements(text.constData(), text.size(),
+                                    pmh_EXT_MEMOIZE, 1, &budget, NULL, NULL,
+                                    &elements, &unparsed);
+    pmh_free_elements(elements);
+    return NULL == unparsed;
+}
+
+// Fewest parser steps a complete parse takes, by bisection, or `limit` if
+// it takes more; unlike the time taken, this does not depend on the machine
+static unsigned long parse_steps(const QByteArray& text, unsigned long limit)
+{
+    if (!parses_within(text, limit))
+        return limit;
+    unsigned long low = 1, high = limit;
+    while (low < high)
+    {
+        const unsigned long mid = low + (high - low) / 2;
+        if (parses_within(text, mid))
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    return low;
+}
+
+void TestPmhParser::unclosed_brackets_take_linear_time()
+{
+    // Each '[' opens a Label that fails only at the end of the paragraph;
+    // in quadratic time, twice the brackets take four times the steps
+    const QByteArray text = QByteArray("[a ").repeated(4000);
+    const unsigned long limit = 100 * 4000;
+    const unsigned long once = parse_steps(text, limit);
+    QVERIFY2(once < limit,
+             qPrintable(QString("%1 brackets took more than %2 steps")
+                        .arg(4000).arg(limit)));
+    QVERIFY2(parses_within(text + text, 3 * once),
+             qPrintable(QString("%1 brackets took %2 steps, %3 took more "
+                                "than %4").arg(4000).arg(once).arg(8000)
+                        .arg(3 * once)));
+}
+
+}
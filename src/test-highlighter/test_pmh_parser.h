@@ -0,0 +1,19 @@
+﻿#ifndef ___HEADFILE_B745E15B_491D_4146_9D8A_6893D07685C3_
+#define ___HEADFILE_B745E15B_491D_4146_9D8A_6893D07685C3_
+
+#include <QObject>
+
+namespace mdtextedit
+{
+
+class TestPmhParser : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void unclosed_brackets_take_linear_time();
+};
+
+}
+
+#endif